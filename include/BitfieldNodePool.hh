@@ -0,0 +1,131 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "MappedArray.hh"
+
+class SnapshotReader;
+class SnapshotWriter;
+
+/// Storage for the 8x8 nodes of a GrassyBitfield
+/*
+  Nodes are held contiguously in an arena, and are located by an
+  open-addressing hash table keyed on the Morton key of the node.
+  Lookup is O(1), rather than the O(log n) of a tree-based map.
+  Erased nodes are placed on a free list and reused by later
+  insertions, so a world whose size is stable does not allocate.
+
+  Indices into the arena remain valid until that node is erased, or
+  the nodes are sorted.  References to nodes are invalidated by
+  insert(), as the arena may be reallocated.
+
+  The arena may be held in memory-mapped files, so that a pool larger
+  than RAM only keeps its active pages resident.  Copies of a pool are
+  held in memory.  The hash table is always held in memory.  Its slots
+  are spread by a hash of the key, so nearby nodes do not share pages
+  of it, and mapping it would keep the whole table resident anyway.
+  With 16 bytes per slot, and two to four slots per node, it takes
+  half to all of the memory of the 64-byte nodes.
+ */
+class BitfieldNodePool {
+public:
+  using Bitfield = std::bitset<64>;
+  using index_t = std::uint32_t;
+  static constexpr index_t npos = index_t(-1);
+
+  struct Node {
+    std::uint64_t key;
+    /// Values of each tile, only meaningful if stored is true.
+    Bitfield bits;
+    /// Bit N is set if there is a node for the subfield at location N.
+    std::uint64_t child_mask;
+    /// Number of filled tiles within the node.
+    std::uint64_t population;
+    /// Sum of the population of each subfield in child_mask.
+    std::uint64_t child_population;
+    /// True if the node holds values.  False if the node exists only
+    /// to give a path to a stored node at a lower layer.
+    bool stored;
+    /// Unused.  The padding is named so that it is zeroed, and nodes
+    /// can be written to snapshots as bytes.
+    std::uint8_t reserved[3];
+    /// Nodes on the same layer to the -x, +x, -y, and +y sides, or
+    /// npos if there is no node on that side.
+    index_t neighbors[4];
+    std::uint32_t reserved_tail;
+  };
+  static_assert(std::has_unique_object_representations_v<Node>,
+                "Node must not have padding, as it is saved as bytes");
+
+  /// Construct an empty pool
+  /*
+    Each node holds num_extra_planes words of values in addition to
+    bits, in the same layout.  They are kept in a separate arena, so
+    that nodes with a single plane do not pay for them.
+   */
+  BitfieldNodePool(unsigned int num_extra_planes = 0);
+
+  index_t find(std::uint64_t key) const;
+  /// Returns the index of the node with the key, creating an empty
+  /// node if none exists.
+  index_t insert(std::uint64_t key);
+  void erase(std::uint64_t key);
+  void clear();
+
+  Node& operator[](index_t index) { return nodes[index]; }
+  const Node& operator[](index_t index) const { return nodes[index]; }
+
+  std::size_t size() const { return num_nodes; }
+  unsigned int get_num_extra_planes() const { return num_extra_planes; }
+
+  /// Move the nodes into files named path.nodes and path.planes
+  void map_to_files(const std::string& path);
+  bool is_file_backed() const { return nodes.is_file_backed(); }
+
+  /// Place the nodes in the arena in order of increasing key
+  /*
+    Morton keys of nearby nodes are close together, so this places
+    nodes that are near each other in space on the same pages.  The
+    nodes are permuted in place, and their neighbor links updated.
+    Every existing index is invalidated.
+   */
+  void sort_by_key();
+
+  /// Write the nodes, in order of increasing key, as a single block
+  void save(SnapshotWriter& out) const;
+  /// Replace the nodes with those written by save
+  /*
+    The block of nodes is copied directly into the arena.  Only the
+    hash table is rebuilt.
+   */
+  void load(SnapshotReader& in);
+
+  /// The extra planes of a node, only meaningful if stored is true.
+  Bitfield* extra_planes(index_t index) {
+    return planes.data() + std::size_t(index)*num_extra_planes;
+  }
+  const Bitfield* extra_planes(index_t index) const {
+    return planes.data() + std::size_t(index)*num_extra_planes;
+  }
+
+private:
+  struct Slot {
+    std::uint64_t key;
+    index_t index;
+  };
+
+  std::size_t slot_for(std::uint64_t key) const;
+  bool is_sorted() const;
+  void rehash(std::size_t new_num_slots);
+
+  MappedArray<Node> nodes;
+  unsigned int num_extra_planes;
+  MappedArray<Bitfield> planes;
+  std::vector<index_t> free_list;
+  std::vector<Slot> slots;
+  std::size_t num_nodes;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+#include "Hash.hh"
+
+/// A counter-based random number generator
+/*
+  Each value is a hash of the key and the number of values drawn so
+  far, so a stream needs no state beyond its key.  Independent streams
+  are made by hashing together whatever identifies them, such as a
+  seed, a creature, and a tick, and can be drawn from in any order or
+  on any thread.  Satisfies UniformRandomBitGenerator.
+ */
+class CounterRng {
+public:
+  using result_type = std::uint64_t;
+
+  explicit CounterRng(std::uint64_t key) : key(key), counter(0) { }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+  result_type operator()() {
+    counter++;
+    return mix64(key + counter*0x9e3779b97f4a7c15ULL);
+  }
+
+private:
+  std::uint64_t key;
+  std::uint64_t counter;
+};
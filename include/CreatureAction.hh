@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+
 enum class CreatureAction {
   NoAction,
   EatFood,
@@ -8,3 +10,6 @@ enum class CreatureAction {
   SpeedUp,
   SlowDown
 };
+
+/// Number of values of CreatureAction
+constexpr std::size_t num_creature_actions = 6;
@@ -1,11 +1,32 @@
 #pragma once
 
-#include <random>
+#include <cstddef>
+#include <memory>
+#include <string>
 
+#include "CounterRng.hh"
 #include "CreatureAction.hh"
 
 class CreatureBrain {
 public:
   virtual ~CreatureBrain() { }
-  virtual CreatureAction choose_action(std::mt19937& gen) = 0;
+  virtual CreatureAction choose_action(CounterRng& gen) = 0;
+  /// Identifies the type of brain in snapshots
+  virtual std::string get_name() const = 0;
+  /// Make the brain of a child of a creature with this brain
+  virtual std::unique_ptr<CreatureBrain> make_child() const = 0;
+
+  /// Choose an action for each of several brains of the same type as this one
+  /*
+    Equivalent to calling choose_action on each brain, in order, with
+    the matching generator.  Each type of brain can override this to
+    handle all of its creatures with a single virtual call, rather
+    than one per creature.
+   */
+  virtual void choose_actions(CounterRng* gens, CreatureBrain* const* brains,
+                              std::size_t num_brains, CreatureAction* actions) {
+    for(std::size_t i=0; i<num_brains; i++) {
+      actions[i] = brains[i]->choose_action(gens[i]);
+    }
+  }
 };
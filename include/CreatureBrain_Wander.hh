@@ -2,7 +2,14 @@
 
 #include "CreatureBrain.hh"
 
-class CreatureBrain_Wander : public CreatureBrain {
+class CreatureBrain_Wander final : public CreatureBrain {
 public:
-  virtual CreatureAction choose_action(std::mt19937& gen);
+  virtual CreatureAction choose_action(CounterRng& gen);
+  virtual std::string get_name() const { return "Wander"; }
+  virtual std::unique_ptr<CreatureBrain> make_child() const {
+    return std::make_unique<CreatureBrain_Wander>();
+  }
+  /// The wander brain has no state, so the brains are not used.
+  virtual void choose_actions(CounterRng* gens, CreatureBrain* const* brains,
+                              std::size_t num_brains, CreatureAction* actions);
 };
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class CreatureTable;
+
+/// A uniform grid of buckets, used to find creatures near a point
+/*
+  The world is divided into square cells, and the creatures are sorted
+  by cell with a counting sort, so a rebuild is linear in the number
+  of creatures.  Distances wrap around the edges of the world, in the
+  same way that creatures do as they move.
+
+  Queries look only at the cells that overlap the search radius, so
+  the cell size should be about the radius of the most common query.
+ */
+class CreatureGrid {
+public:
+  /// An empty grid
+  CreatureGrid();
+
+  /// Sort the creatures into cells of at least cell_size on a side
+  /*
+    The number of cells on each side divides the world evenly, so the
+    cells may be slightly larger than cell_size.  There are at most a
+    few cells per creature, so a large world with few creatures has
+    larger cells.
+   */
+  void build(const CreatureTable& creatures, double world_size, double cell_size);
+
+  /// Append the index of each creature within radius of (x,y)
+  /*
+    Creatures are appended in order of increasing index.
+   */
+  void within_radius(double x, double y, double radius,
+                     std::vector<std::uint32_t>& output) const;
+
+  /// Append the indices of the k creatures nearest to (x,y)
+  /*
+    Creatures are appended from nearest to farthest, with ties broken
+    by the lower index.  Fewer than k are appended if there are fewer
+    than k creatures.
+   */
+  void nearest(double x, double y, std::size_t k,
+               std::vector<std::uint32_t>& output) const;
+
+  std::size_t size() const { return entries.size(); }
+  std::uint32_t get_cells_per_side() const { return cells_per_side; }
+
+private:
+  struct Entry {
+    double x;
+    double y;
+    std::uint32_t creature;
+  };
+
+  std::uint32_t cell_of(double pos) const;
+  /// Distance along one axis, the shorter way around the world
+  double axis_dist(double a, double b) const;
+  double dist2(const Entry& entry, double x, double y) const;
+
+  double world_size;
+  double cell_size;
+  std::uint32_t cells_per_side;
+  /// Entries of cell c are in [cell_start[c], cell_start[c+1]).
+  std::vector<std::uint32_t> cell_start;
+  /// Creatures, sorted by cell then by index, with their positions.
+  std::vector<Entry> entries;
+  /// Cell of each creature, kept between builds to avoid reallocation.
+  std::vector<std::uint32_t> cells;
+};
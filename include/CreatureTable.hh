@@ -0,0 +1,221 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <typeindex>
+#include <vector>
+
+#include "CounterRng.hh"
+#include "CreatureAction.hh"
+#include "GVector.hh"
+#include "TileField.hh"
+
+class CreatureBrain;
+class GrassyBitfield;
+class SnapshotReader;
+class SnapshotWriter;
+class ThreadPool;
+
+/// Every creature of a world, stored as a structure of arrays
+/*
+  Each property of the creatures is held in its own contiguous
+  array, indexed by creature.  Movement, wrapping around the edges,
+  and speed decay are applied to every creature in a single loop over
+  these arrays, which the compiler can vectorize.
+
+  Creatures are grouped by the type of their brain, and each group is
+  split into fixed-size batches.  Each batch chooses its actions with
+  a single call, then sorts its creatures by action, so that each
+  action is applied in its own loop.  Batches can be run on any
+  thread, in any order.
+
+  Removing a creature moves the last creature into its place, so the
+  arrays stay packed, and the index of a creature can change.  Each
+  creature also has an id that does not change while it is alive.
+  Ids are reused from a free list, tagged with a generation that
+  changes each time, so the id of a dead creature is never mistaken
+  for a newer one.  The brains of dead creatures are kept for the
+  next creature of the same type, so a steady rate of births and
+  deaths does not allocate.
+ */
+class CreatureTable {
+public:
+  /// Identifies a creature for as long as it lives
+  /*
+    The low 32 bits are the slot, which is reused once the creature
+    dies, and the high 32 bits count the uses of the slot.
+   */
+  using Id = std::uint64_t;
+
+  /// The food that a creature can sense around it
+  struct FoodSense {
+    /// Fraction of each cone that holds food
+    double left;
+    double center;
+    double right;
+    /// Distance to the nearest food straight ahead, or the sensing
+    /// radius if there is none within it
+    double ahead;
+  };
+
+  CreatureTable();
+  ~CreatureTable();
+
+  CreatureTable(CreatureTable&&);
+  CreatureTable& operator=(CreatureTable&&);
+
+  /// Add a creature, facing along the direction angle, in radians
+  Id add(std::unique_ptr<CreatureBrain> brain, GVector<2> position,
+         double direction = 0, double speed = 0);
+  /// Remove the creature at index i, moving the last creature to i
+  void remove(std::size_t i);
+
+  std::size_t size() const { return x.size(); }
+
+  /// Advance every creature by one iteration
+  /*
+    Each creature chooses and performs an action, then every creature
+    moves.  Each creature draws random numbers from its own stream,
+    keyed by the seed, the id of the creature, and the tick, so the
+    result does not depend on the order in which creatures are
+    updated, or on the number of threads.  If pool is not null, the
+    creatures are divided between its threads.
+
+    The field is not modified.  Any changes the creatures make to the
+    field are appended to field_updates, to be applied once all
+    creatures have been updated.  If several creatures try to eat the
+    same tile, the one with the lowest index gets it.
+
+    If the lifecycle is enabled, creatures then pay for the iteration
+    from their energy.  Creatures with enough energy split in two, and
+    creatures with none left die.
+   */
+  void update(std::uint64_t seed, std::uint64_t tick, const TileField& field,
+              std::vector<TileField::TileUpdate>& field_updates,
+              ThreadPool* pool = nullptr);
+
+  /// Move each creature along its direction, then slow it down
+  /*
+    Positions wrap around the edges of a world of the given size.
+    Each creature is assumed to move less than the size of the world
+    in one iteration.
+   */
+  void move(double world_size, ThreadPool* pool = nullptr);
+
+  /// Sense the food around every creature
+  /*
+    The center cone is 60 degrees wide, facing the direction of the
+    creature, with the left and right cones to either side of it.
+    Each cone reaches out to radius.  output is resized to hold one
+    entry per creature.  If pool is not null, the creatures are
+    divided between its threads.
+   */
+  void sense_food(const GrassyBitfield& food, double radius,
+                  std::vector<FoodSense>& output, ThreadPool* pool = nullptr) const;
+
+  /// Enable energy, births, and deaths
+  /*
+    Each creature gains energy from food, and spends a fixed amount
+    per iteration.  Disabled by default, in which case the energy is
+    unchanged and creatures live forever.
+   */
+  void set_lifecycle(bool enabled) { lifecycle = enabled; }
+  bool get_lifecycle() const { return lifecycle; }
+
+  Id get_id(std::size_t i) const;
+  /// The index of the creature with the id, if it is still alive
+  std::optional<std::size_t> find(Id id) const;
+
+  GVector<2> get_position(std::size_t i) const { return {x[i], y[i]}; }
+  void set_position(std::size_t i, GVector<2> pos) { x[i] = pos.X(); y[i] = pos.Y(); }
+  /// Direction the creature is facing, as an angle in radians
+  double get_direction(std::size_t i) const;
+  double get_speed(std::size_t i) const { return speed[i]; }
+  double get_energy(std::size_t i) const { return energy[i]; }
+  static double get_radius();
+
+  void save(SnapshotWriter& out) const;
+  /// Read a table written by save
+  /*
+    Tables written before creatures had ids and energy hold only the
+    brains and motion of the creatures.  Those are read if
+    with_lifecycle is false.
+   */
+  static CreatureTable load(SnapshotReader& in, bool with_lifecycle = true);
+
+private:
+  /// A tile that a creature tried to eat
+  struct FoodClaim {
+    std::uint32_t x;
+    std::uint32_t y;
+    std::uint32_t creature;
+  };
+
+  /// A range of the creatures of one brain type, updated together
+  struct Batch {
+    std::size_t group;
+    std::size_t begin;
+    std::size_t end;
+    std::vector<CounterRng> gens;
+    std::vector<CreatureAction> actions;
+    std::array<std::vector<std::uint32_t>, num_creature_actions> by_action;
+    std::vector<FoodClaim> claims;
+  };
+
+  /// Add a creature in a new slot, returning its index
+  std::size_t spawn(std::unique_ptr<CreatureBrain> brain, std::uint32_t group,
+                    double pos_x, double pos_y, double direction_x, double direction_y,
+                    double speed, double energy);
+  std::uint32_t group_of(const CreatureBrain& brain);
+  void make_batches();
+  void update_batch(Batch& batch, std::uint64_t seed, std::uint64_t tick,
+                    const TileField& field);
+  void resolve_claims(std::vector<TileField::TileUpdate>& field_updates);
+  void move_range(std::size_t begin, std::size_t end, double world_size);
+  void births_and_deaths();
+  void eat_food(std::uint32_t i, const TileField& field,
+                std::vector<FoodClaim>& claims) const;
+  void turn(std::size_t i, double delta_angle);
+  void change_speed(std::size_t i, double delta_v);
+  double get_turn_angle(std::size_t i) const;
+
+  /// Position of each creature
+  std::vector<double> x;
+  std::vector<double> y;
+  /// Unit vector with the direction each creature is facing
+  std::vector<double> dir_x;
+  std::vector<double> dir_y;
+  /// Current speed of each creature
+  std::vector<double> speed;
+  std::vector<double> energy;
+  /// Slot of the id of each creature
+  std::vector<std::uint32_t> slots;
+  std::vector<std::unique_ptr<CreatureBrain>> brains;
+  /// Index into brain_types of the brain of each creature
+  std::vector<std::uint32_t> brain_groups;
+
+  /// Generation of each slot, incremented when its creature dies
+  std::vector<std::uint32_t> slot_generation;
+  /// Index of the creature in each slot, if the slot is in use
+  std::vector<std::uint32_t> slot_index;
+  /// Slots not in use, taken from the back
+  std::vector<std::uint32_t> free_slots;
+
+  std::vector<std::type_index> brain_types;
+  /// Brains of dead creatures of each type, to be reused
+  std::vector<std::vector<std::unique_ptr<CreatureBrain>>> spare_brains;
+
+  bool lifecycle;
+
+  /// Scratch buffers for update, kept to avoid reallocation.
+  std::vector<std::uint32_t> order;
+  std::vector<CreatureBrain*> ordered_brains;
+  std::vector<std::size_t> group_start;
+  std::vector<Batch> batches;
+  std::vector<FoodClaim> claims;
+  std::vector<std::uint32_t> parents;
+  std::vector<std::uint32_t> dead;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "TileField.hh"
+
+/// The dense backend of a TileField
+/*
+  Each row of tiles is held as consecutive 64-bit words, one bit per
+  tile.  Growth shifts whole words at a time, so its cost depends
+  only on the area of the field, and not on how fragmented the food
+  is.  Memory use is 8^(2*num_layers)/8 bytes, so this is only
+  suitable for fields of a few layers.
+
+  Only a single plane, with deterministic growth, is supported.
+ */
+class DenseBitfield final : public TileField {
+public:
+  DenseBitfield(unsigned int num_layers, bool initial_value=false, bool edge_wrap=true);
+  /// Copy the values and edge wrapping of another field
+  explicit DenseBitfield(const TileField& other);
+
+  std::uint32_t get_size() const override { return size; }
+  unsigned int get_num_layers() const override { return num_layers; }
+  bool get_edge_wrap() const override { return edge_wrap; }
+  std::uint64_t num_filled() const override { return population; }
+
+  bool get_val(std::uint32_t x, std::uint32_t y, unsigned int plane=0) const override;
+  void set_val(std::uint32_t x, std::uint32_t y, bool val, unsigned int plane=0) override;
+  /// Equivalent to calling set_val for each update, in order
+  /*
+    If edge wrapping is disabled, tiles off the edge are an error.
+   */
+  void apply_updates(const std::vector<TileUpdate>& updates) override;
+  /// Replace the contents with the listed filled tiles
+  /*
+    Coordinates wrap around the edges as in set_val.  If edge
+    wrapping is disabled, tiles off the edge are an error.
+   */
+  void load_tiles(const std::vector<Location>& tiles) override;
+
+  std::optional<Location> find_nearest_set(double x, double y, double radius) const override;
+
+  void growth_iteration() override;
+  /// As growth_iteration, appending each tile that was filled to new_tiles
+  void growth_iteration(std::vector<TileUpdate>& new_tiles);
+
+private:
+  // Wraps or checks the coordinates, returning false if off the edge.
+  bool wrap(std::uint32_t& x, std::uint32_t& y) const;
+  void check_plane(unsigned int plane) const;
+  std::uint64_t* row(std::uint32_t y) { return words.data() + std::size_t(y)*words_per_row; }
+  const std::uint64_t* row(std::uint32_t y) const {
+    return words.data() + std::size_t(y)*words_per_row;
+  }
+  void grow_row(std::uint32_t y, std::uint64_t* output) const;
+  void nearest_in_row(std::uint32_t tile_y, NearestSearch& search) const;
+  /// First filled tile at or after start, continuing around the
+  /// edge if wrapping, or size if there is none.
+  std::uint32_t next_set(const std::uint64_t* words, std::uint32_t start) const;
+  /// As next_set, but at or before start.
+  std::uint32_t prev_set(const std::uint64_t* words, std::uint32_t start) const;
+
+  unsigned int num_layers;
+  std::uint32_t size;
+  bool edge_wrap;
+  std::uint32_t words_per_row;
+  /// Bits of the last word of each row that are tiles.
+  std::uint64_t last_word_mask;
+  std::uint64_t population;
+  std::vector<std::uint64_t> words;
+  /// Scratch buffer for growth_iteration, kept to avoid reallocation.
+  std::vector<std::uint64_t> next_words;
+  /// A row of zeros, used in place of the rows past the edges.
+  std::vector<std::uint64_t> empty_row;
+};
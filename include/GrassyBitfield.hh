@@ -1,15 +1,33 @@
 #pragma once
 
+#include <array>
 #include <bitset>
 #include <cstdint>
-#include <map>
+#include <memory>
+#include <optional>
+#include <string>
 #include <vector>
 
+#include "BitfieldNodePool.hh"
+#include "GrowthQuadtree.hh"
+#include "TileField.hh"
 
-class GrassyBitfield {
+class SnapshotReader;
+class SnapshotWriter;
+class ThreadPool;
+
+/// The sparse backend of a TileField
+/*
+  Each node of the tree is an 8x8 bitfield.  A tile of a node either
+  holds a single value for its entire subfield, or refers to a node
+  on the layer below.
+ */
+class GrassyBitfield final : public TileField {
 public:
   using Bitfield = std::bitset<64>;
 
+  static const unsigned int max_planes = 4;
+
   struct DrawField {
     bool values[8][8];
     std::uint32_t x_min;
@@ -17,41 +35,438 @@ public:
     std::uint32_t width;
   };
 
+  struct FieldBounds {
+    std::uint32_t x_min;
+    std::uint32_t y_min;
+    std::uint32_t width;
+  };
+
+  /// Changes to the draw fields between two versions
+  /*
+    If full_refresh is true, changed holds every field, and any
+    fields held from earlier versions should be discarded.  Otherwise,
+    changed holds the fields that were created or modified, and
+    removed holds the fields that no longer exist.  Fields are in
+    pre-order, as in get_draw_fields.
+   */
+  struct DrawFieldUpdate {
+    std::uint64_t version;
+    bool full_refresh;
+    std::vector<DrawField> changed;
+    std::vector<FieldBounds> removed;
+  };
+
   /// Construct a GrassyBitfield
   /*
     Each recursive bitfield is square, and is of size 8^num_layers.
     There must be at least 1 layer present.
+
+    Each tile holds one bit in each of num_planes planes, at most
+    max_planes.  The planes share a single tree, and a field is only
+    collapsed if it is uniform in every plane.  Each plane grows
+    independently.  The planes may be read together as the bits of a
+    level, with plane 0 as the lowest bit.  Other than growth, every
+    query and operation without a plane argument uses plane 0.
+    Operations that rebuild the tree from scratch (bulk loading,
+    region operations) require a single plane.
    */
   GrassyBitfield(unsigned int num_layers, bool initial_value=false,
-                 bool edge_wrap=true);
+                 bool edge_wrap=true, unsigned int num_planes=1);
 
-  std::uint64_t num_filled() const;
-  bool get_val(std::uint32_t x, std::uint32_t y) const;
-  void set_val(std::uint32_t x, std::uint32_t y, bool val);
+  std::uint64_t num_filled() const override;
+  /// Number of filled tiles in [x_min, x_max) by [y_min, y_max)
+  std::uint64_t count_in_rect(std::uint32_t x_min, std::uint32_t y_min,
+                              std::uint32_t x_max, std::uint32_t y_max) const;
+  bool get_val(std::uint32_t x, std::uint32_t y, unsigned int plane=0) const override;
+  void set_val(std::uint32_t x, std::uint32_t y, bool val, unsigned int plane=0) override;
 
-  void growth_iteration();
+  /// The bits of every plane of a tile, with plane 0 as the lowest bit
+  unsigned int get_level(std::uint32_t x, std::uint32_t y) const;
+  void set_level(std::uint32_t x, std::uint32_t y, unsigned int level);
+
+  /// Equivalent to calling set_val for each update, in order
+  /*
+    The updates are sorted by address, and each block with updates
+    is written once, as a single word.  If a tile is updated more
+    than once, the last update is used.  If edge wrapping is disabled,
+    tiles off the edge are an error.
+   */
+  void apply_updates(const std::vector<TileUpdate>& updates) override;
+
+  /// Replace the contents with the listed filled tiles
+  /*
+    Gives the same result as calling set_val for each tile on an empty
+    field, but builds each node once, from the bottom up.  The tiles
+    may be in any order, and may contain duplicates.  Coordinates
+    wrap around the edges as in set_val.  If edge wrapping is
+    disabled, tiles off the edge are an error.
+   */
+  void load_tiles(const std::vector<Location>& tiles) override;
+  /// Replace the contents with a row-major raster of get_size()^2 values
+  void load_raster(const std::vector<bool>& raster);
+
+  /// Set every tile in [x_min, x_max) by [y_min, y_max)
+  /*
+    The rectangle is clipped to the edges of the field.  Subfields
+    that lie entirely inside or outside the rectangle are handled as
+    a whole, as are the region operations below.
+   */
+  void fill_rect(std::uint32_t x_min, std::uint32_t y_min,
+                 std::uint32_t x_max, std::uint32_t y_max);
+  /// Clear every tile in [x_min, x_max) by [y_min, y_max)
+  void clear_rect(std::uint32_t x_min, std::uint32_t y_min,
+                  std::uint32_t x_max, std::uint32_t y_max);
+  /// Set every tile whose center is strictly within the radius of (x,y)
+  /*
+    Distances wrap around the edges if edge wrapping is enabled, as in
+    find_nearest_set.
+   */
+  void fill_disk(double x, double y, double radius);
+
+  /// Set every tile that is set in other
+  /*
+    Both fields must have the same number of layers.
+   */
+  void union_with(const GrassyBitfield& other);
+  /// Clear every tile that is not set in other
+  void intersect_with(const GrassyBitfield& other);
+  /// Clear every tile that is set in other
+  void subtract(const GrassyBitfield& other);
+
+  /// Find the filled tile whose center is nearest to (x,y)
+  /*
+    Only tiles whose center is strictly within the radius are
+    considered.  Distances wrap around the edges if edge wrapping is
+    enabled.  If several tiles are equally near, the one with the
+    lowest y, then the lowest x, is returned.  Returns nothing if no
+    such tile is filled.
+   */
+  std::optional<Location> find_nearest_set(double x, double y, double radius) const override;
+  /// As find_nearest_set, but also clears the tile that was found.
+  std::optional<Location> take_nearest(double x, double y, double radius);
+
+  /// Number of filled tiles whose center is in a sector of a disk
+  /*
+    The sector holds the tile centers strictly within the radius of
+    (x,y), whose direction from (x,y) is within half_angle of
+    direction, both in radians.  A tile centered exactly on (x,y) is
+    in every sector.  Distances wrap around the edges if edge wrapping
+    is enabled, as in find_nearest_set.  Subfields that are uniform,
+    or that lie entirely inside or outside the sector, are counted as
+    a whole, and each remaining block with a single popcount.
+   */
+  std::uint64_t count_in_sector(double x, double y, double radius,
+                                double direction, double half_angle) const;
+  /// Distance along a ray to the first filled tile
+  /*
+    The ray starts at (x,y) and travels in direction, in radians,
+    wrapping around the edges if edge wrapping is enabled.  Returns
+    the distance at which it enters the first filled tile, 0 if (x,y)
+    is in a filled tile, or nothing if no filled tile is reached
+    within max_distance.  Uniform subfields are crossed in a single
+    step.  Without edge wrapping, a ray that starts off the field
+    finds nothing.  With edge wrapping, max_distance may be infinite,
+    but the ray is followed for at most one period in each axis and
+    no farther than 2*size, so a miss costs at most a few block
+    crossings per tile of the field's width.
+   */
+  std::optional<double> cast_ray(double x, double y, double direction,
+                                 double max_distance) const;
+
+  /// Spread food from each filled tile to its four neighbors
+  /*
+    Only the blocks near a change since the previous iteration are
+    examined, so saturated or empty regions have no per-iteration
+    cost.
+   */
+  void growth_iteration() override;
+
+  /// Equivalent to calling growth_iteration num_iterations times
+  /*
+    Large numbers of iterations are evaluated with a memoized
+    quadtree (Hashlife), so regions that are repeated, in space or
+    between calls, are only evolved once.  The memo is kept between
+    calls.
+   */
+  void growth_iterations(std::uint64_t num_iterations);
+
+  /// Spread food to each neighbor with the given probability
+  /*
+    The default of 1 spreads to every neighbor on each iteration.  The
+    probability is rounded to a multiple of 1/256.  The random choices
+    depend only on the seed, the number of growth iterations since the
+    seed was set, and the location, so the result does not depend on
+    the number of threads.  Growth with a probability below 1 is not
+    memoized by growth_iterations.
+   */
+  void set_growth_probability(double probability);
+  double get_growth_probability() const;
+  void set_growth_seed(std::uint64_t seed);
+
+  /// Set the number of threads used by growth_iteration
+  /*
+    The growth of each top-level subfield is determined independently,
+    then applied in the same order as with a single thread, so the
+    result does not depend on the number of threads.  Copies of a
+    GrassyBitfield share the same threads.
+   */
+  void set_num_threads(unsigned int num_threads);
+  unsigned int get_num_threads() const;
+  /// As set_num_threads, sharing threads that are also used elsewhere
+  void set_thread_pool(std::shared_ptr<ThreadPool> pool);
+
+  /// Hold the nodes in memory-mapped files, for worlds larger than RAM
+  /*
+    The files are named path.nodes and path.planes, and are created
+    or truncated.  They are scratch space, and are only meaningful
+    while the field exists.  Pages of the files that are not in use
+    can be dropped from memory by the kernel, so only the active
+    regions of the world stay resident.  The hash table that locates
+    the nodes, and copies of the field, are held in memory.
+   */
+  void map_to_file(const std::string& path);
+  /// Arrange the nodes in memory by their Morton key
+  /*
+    Nodes that are near each other in space are then near each other
+    in memory, and share pages.  Nodes created later are placed
+    wherever there is space, so this may be repeated as the world
+    changes.  Done automatically when mapping to a file, and after
+    rebuilding a field that is mapped to a file.
+   */
+  void reorder_nodes();
+
+  /// Write the field in a binary snapshot format
+  /*
+    The nodes are written in order of their Morton key, which is a
+    pre-order traversal of the tree, as a single block.  The growth
+    settings and the blocks pending growth are included, so growth
+    continues as it would have.  The number of threads is not saved.
+   */
+  void save(SnapshotWriter& out) const;
+  /// Read a field written by save
+  /*
+    The nodes are copied directly from the snapshot.  Every version
+    before the snapshot needs a full refresh of the draw fields.
+   */
+  static GrassyBitfield load(SnapshotReader& in);
 
   std::vector<DrawField> get_draw_fields() const;
+  /// Draw fields overlapping [x_min, x_max) by [y_min, y_max), with limited detail
+  /*
+    Fields that lie outside the viewport are skipped.  Fields whose
+    tiles are narrower than min_tile_width are not returned.  Instead,
+    each tile that holds them is returned as filled if at least half
+    of the tile is filled.  The number of fields returned is then
+    limited by the size of the viewport in units of min_tile_width,
+    regardless of the size of the world.
+   */
+  std::vector<DrawField> get_draw_fields(std::uint32_t x_min, std::uint32_t y_min,
+                                         std::uint32_t x_max, std::uint32_t y_max,
+                                         std::uint32_t min_tile_width) const;
+
+  /// Number of changes made to the draw fields so far
+  std::uint64_t get_version() const { return version; }
+  /// The changes to the draw fields made after the given version
+  /*
+    Only a limited history is kept, proportional to the number of
+    fields.  If the version is older than the history, or is not a
+    version of this field, a full refresh is returned instead.
+   */
+  DrawFieldUpdate get_draw_fields_since(std::uint64_t since) const;
 
-  std::uint32_t get_size() const;
-  unsigned int get_num_layers() const { return num_layers; }
+  std::uint32_t get_size() const override;
+  unsigned int get_num_layers() const override { return num_layers; }
+  bool get_edge_wrap() const override { return edge_wrap; }
+  unsigned int get_num_planes() const { return num_planes; }
+
+  /// An immutable copy of a GrassyBitfield, which may be read from any thread
+  /*
+    Each node of the tree is shared between every frozen copy in
+    which it is unchanged.  The copy stays valid and consistent while
+    the original continues to change.
+   */
+  class Frozen {
+  public:
+    Frozen();
+
+    std::uint64_t get_version() const { return version; }
+    std::uint32_t get_size() const;
+    std::uint64_t num_filled() const { return population; }
+    bool get_val(std::uint32_t x, std::uint32_t y, unsigned int plane=0) const;
+    unsigned int get_level(std::uint32_t x, std::uint32_t y) const;
+    std::vector<DrawField> get_draw_fields() const;
+    /// The draw fields that differ from an earlier copy
+    /*
+      As GrassyBitfield::get_draw_fields_since, but found by comparing
+      the two trees, so it can be called from any thread.  Subfields
+      shared with previous are skipped, so the cost depends on the
+      number of changes.  If previous is empty, or of another size,
+      every field is returned as a full refresh.
+     */
+    DrawFieldUpdate get_draw_fields_since(const Frozen& previous) const;
+
+  private:
+    friend class GrassyBitfield;
+    struct Node;
+
+    void append_draw_fields(const Node& node, std::vector<DrawField>& output) const;
+    static void append_changes(const Node* previous, const Node* current,
+                               DrawFieldUpdate& output);
+
+    std::shared_ptr<const Node> root;
+    unsigned int num_layers;
+    unsigned int num_planes;
+    bool edge_wrap;
+    std::uint64_t version;
+    std::uint64_t population;
+  };
+
+  /// Make a frozen copy of the current state
+  /*
+    Only the nodes changed since the previous call, and their parents,
+    are copied.  Everything else is shared with the previous copy.
+   */
+  Frozen freeze();
 
 private:
+  using index_t = BitfieldNodePool::index_t;
+
+  struct BlockUpdate {
+    std::uint64_t key;
+    Bitfield bits;
+  };
+
+  struct Region;
+  struct Sector;
+
+  /// A subfield of uniform value, as found by uniform_block
+  struct UniformBlock {
+    bool value;
+    std::uint32_t x_min;
+    std::uint32_t y_min;
+    std::uint32_t width;
+  };
+
+  using Planes = std::array<Bitfield, max_planes>;
+
+  struct BlockPlanes {
+    std::uint64_t key;
+    Planes planes;
+    /// False if the block did not grow, but could have.
+    bool grew;
+  };
+
+  struct NodeChange {
+    std::uint64_t version;
+    std::uint64_t key;
+  };
+
+  enum class SetOperation { Union, Intersection, Difference };
+
+  enum class CellState { Empty, Full, Mixed };
+
   std::uint64_t get_address_wrap(std::uint32_t x, std::uint32_t y) const;
+  std::uint64_t top_key() const;
+
+  index_t find_stored(std::uint64_t key) const;
+  index_t lowest_stored_node(std::uint64_t address, unsigned int min_layer) const;
+  void store_node(std::uint64_t key, Bitfield bits);
+  void store_node(std::uint64_t key, const Planes& planes);
+  Bitfield& plane_bits(index_t index, unsigned int plane);
+  const Bitfield& plane_bits(index_t index, unsigned int plane) const;
+  unsigned int level_at(index_t index, unsigned int loc) const;
+  void require_single_plane(const char* operation) const;
+  unsigned int all_planes() const { return (1u << num_planes) - 1; }
+  void erase_node(std::uint64_t key);
+  void mark_dirty(std::uint64_t key);
+  void mark_all_dirty();
+  void append_draw_fields(index_t index, bool parent_value,
+                          std::uint32_t x_min, std::uint32_t y_min,
+                          std::uint32_t x_max, std::uint32_t y_max,
+                          std::uint32_t min_tile_width,
+                          std::vector<DrawField>& output) const;
+  void find_nearest_set(std::uint64_t key, Bitfield bitfield,
+                        std::uint64_t child_mask, NearestSearch& search) const;
+
+  Bitfield get_field(std::uint64_t address, unsigned int layer, unsigned int plane=0) const;
+  Planes get_planes(std::uint64_t address, unsigned int layer) const;
+  std::uint64_t neighbor_key(std::uint64_t key, int dx, int dy) const;
+  void link_neighbors(index_t index);
+  void unlink_neighbors(index_t index);
+  bool is_valid_key(std::uint64_t key) const;
+  /// Throws std::runtime_error if the loaded nodes do not form a tree
+  void validate_nodes() const;
+  Bitfield determine_new_growth(std::uint64_t key, index_t index, unsigned int plane,
+                                Bitfield bitfield, bool& deferred) const;
+  void collect_growth(const std::uint64_t* begin, const std::uint64_t* end,
+                      std::vector<BlockPlanes>& output) const;
+  void set_block(std::uint64_t key, const Planes& planes);
+  bool set_planes(std::uint64_t address, unsigned int level, unsigned int plane_mask,
+                  unsigned int first_layer = 0);
+  void update_population(std::uint64_t address);
+  void mark_block_changed(std::uint64_t key);
+  std::uint64_t recount_population(index_t index, bool parent_value);
+  void mark_all_changed(index_t index, bool parent_value);
+
+  GrowthQuadtree::node_t to_quadtree(index_t index, bool parent_value);
+  void load_quadtree(GrowthQuadtree::node_t world);
+  void load_blocks(const std::vector<BlockUpdate>& blocks);
+  CellState store_field(std::uint64_t key, Bitfield full_tiles, bool any_mixed);
 
-  void determine_new_growth(
-    std::uint64_t key,
-    bool parent_value,
-    std::map<std::uint64_t, Bitfield>& output
-  ) const;
-  bool exists_or_has_subfields(std::uint64_t key) const;
-  bool has_subfields(std::uint64_t key) const;
-  void set_val(std::uint64_t address, bool val);
-  std::uint64_t num_filled(std::uint64_t key, bool parent_value) const;
+  Region rect_region(std::uint32_t x_min, std::uint32_t y_min,
+                     std::uint32_t x_max, std::uint32_t y_max) const;
+  void apply_region(const Region& region, SetOperation op);
+  void combine_with(const GrassyBitfield& other, SetOperation op);
+  CellState combine_field(const BitfieldNodePool& old_nodes, std::uint64_t key,
+                          index_t index, bool value,
+                          const Region& region, SetOperation op);
+  void finish_rebuild();
+  std::shared_ptr<const Frozen::Node> freeze_node(
+    index_t index, const Frozen::Node* previous,
+    const std::uint64_t* changed_begin, const std::uint64_t* changed_end) const;
+  CellState build_from_quadtree(std::uint64_t key, GrowthQuadtree::node_t quad);
+  std::uint64_t count_in_rect(index_t index, bool parent_value,
+                              std::uint32_t x_min, std::uint32_t y_min,
+                              std::uint32_t x_max, std::uint32_t y_max) const;
+  std::uint64_t count_in_sector(index_t index, bool parent_value, const Sector& sector) const;
+  /// The largest uniform subfield that holds the tile
+  UniformBlock uniform_block(std::uint32_t x, std::uint32_t y) const;
 
   unsigned int num_layers;
-  std::map<std::uint64_t, Bitfield> bitfields;
+  unsigned int num_planes;
+  BitfieldNodePool nodes;
   bool edge_wrap;
+
+  /// Keys of the layer-0 blocks that have changed since the last growth.
+  std::vector<std::uint64_t> changed_blocks;
+  /// Number of changed_blocks after duplicates were last removed.
+  std::size_t compacted_changed_blocks;
+  /// Scratch buffers for growth_iteration, kept to avoid reallocation.
+  std::vector<std::uint64_t> frontier;
+  std::vector<BlockPlanes> pending_growth;
+
+  std::shared_ptr<ThreadPool> thread_pool;
+  std::vector<std::size_t> subtree_starts;
+  std::vector<std::vector<BlockPlanes>> subtree_growth;
+
+  GrowthQuadtree growth_memo;
+
+  /// Probability of spreading to each neighbor, in units of 1/256.
+  std::uint32_t growth_threshold;
+  std::uint64_t growth_seed;
+  /// Number of growth iterations since the seed was set.
+  std::uint64_t growth_generation;
+
+  /// Incremented for each change to a stored node.
+  std::uint64_t version;
+  /// Each change to a stored node, in order of increasing version.
+  std::vector<NodeChange> change_log;
+  /// Changes up to and including this version are no longer logged.
+  std::uint64_t forgotten_version;
+
+  /// Root of the most recent frozen copy, and the version it was made at.
+  std::shared_ptr<const Frozen::Node> frozen_root;
+  std::uint64_t frozen_version;
 };
 
 std::ostream& operator<<(std::ostream& out, const GrassyBitfield::DrawField& f);
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/// Hash-consed quadtree that memoizes the growth of its nodes
+/*
+  Used by GrassyBitfield to advance growth by many iterations at once,
+  following the Hashlife algorithm.  Every distinct square of tiles is
+  represented by a single node, so repeated regions are only evolved
+  once.  The smallest nodes are 8x8 leaves, stored as a 64-bit word in
+  the same layout as GrassyBitfield::Bitfield.
+
+  A node at level k is 2^k tiles wide, and has four children at level
+  k-1, ordered as (low x, low y), (high x, low y), (low x, high y),
+  (high x, high y).
+ */
+class GrowthQuadtree {
+public:
+  using node_t = std::uint32_t;
+
+  static const unsigned int leaf_level = 3;
+
+  GrowthQuadtree();
+
+  node_t leaf(std::uint64_t bits);
+  node_t join(node_t low_left, node_t low_right, node_t high_left, node_t high_right);
+  node_t uniform(unsigned int level, bool value);
+
+  unsigned int level(node_t node) const { return nodes[node].level; }
+  std::uint64_t leaf_bits(node_t node) const { return nodes[node].bits; }
+  node_t child(node_t node, unsigned int i) const { return nodes[node].children[i]; }
+  bool is_uniform(node_t node, bool value);
+
+  /// Returns the center of the node after 2^log2_steps iterations of growth
+  /*
+    The node must be at least 16x16 (level 4), and log2_steps can be
+    at most level-2.  The center is half the width of the node.
+   */
+  node_t advance(node_t node, unsigned int log2_steps);
+
+  /// Number of nodes held, including memoized results
+  std::size_t size() const { return nodes.size(); }
+  void clear();
+
+private:
+  struct Node {
+    std::uint64_t bits;
+    node_t children[4];
+    unsigned int level;
+  };
+
+  struct BranchKey {
+    std::uint64_t low_children;
+    std::uint64_t high_children;
+    bool operator==(const BranchKey& other) const {
+      return (low_children == other.low_children &&
+              high_children == other.high_children);
+    }
+  };
+
+  struct BranchKeyHash {
+    std::size_t operator()(const BranchKey& key) const;
+  };
+
+  node_t center(node_t node);
+  node_t advance_base(node_t node, unsigned int num_steps);
+
+  std::vector<Node> nodes;
+  std::unordered_map<std::uint64_t, node_t> leaves;
+  std::unordered_map<BranchKey, node_t, BranchKeyHash> branches;
+  std::unordered_map<std::uint64_t, node_t> results;
+  std::vector<node_t> uniform_nodes[2];
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+/// The 64-bit finalizer of SplitMix64
+/*
+  Every bit of the input affects every bit of the output, so keys that
+  differ only in a few bits, such as nearby Morton keys or consecutive
+  counters, give unrelated values.
+ */
+inline std::uint64_t mix64(std::uint64_t value) {
+  value ^= value >> 30;
+  value *= 0xbf58476d1ce4e5b9ULL;
+  value ^= value >> 27;
+  value *= 0x94d049bb133111ebULL;
+  value ^= value >> 31;
+  return value;
+}
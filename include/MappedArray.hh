@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+/// A block of memory from mmap, optionally backed by a file
+/*
+  Without a file, the memory is anonymous, as from malloc.  With a
+  file, the memory is a shared mapping of the file, so pages that
+  have not been used recently can be written out and dropped by the
+  kernel, rather than being held in RAM or swap.  The file is scratch
+  space, whose contents are only meaningful while it is mapped.
+ */
+class MappedBuffer {
+public:
+  MappedBuffer();
+  ~MappedBuffer();
+
+  MappedBuffer(const MappedBuffer&) = delete;
+  MappedBuffer& operator=(const MappedBuffer&) = delete;
+  MappedBuffer(MappedBuffer&& other);
+  MappedBuffer& operator=(MappedBuffer&& other);
+
+  /// Move the contents into the file, which is created or truncated
+  void map_file(const std::string& path);
+  bool is_file_backed() const { return fd != -1; }
+
+  /// Grow the buffer to at least num_bytes, keeping its contents
+  /*
+    New memory is zero-filled.  Pointers into the buffer are
+    invalidated.
+   */
+  void reserve(std::size_t num_bytes);
+
+  void* data() { return base; }
+  const void* data() const { return base; }
+  std::size_t capacity() const { return num_bytes; }
+
+private:
+  void* map(std::size_t num_bytes);
+  void release();
+
+  void* base;
+  std::size_t num_bytes;
+  int fd;
+};
+
+/// A std::vector-like array of trivially copyable values in a MappedBuffer
+/*
+  Copies are always held in anonymous memory.  Assigning to an array
+  copies the values, but keeps the storage of the array, so an array
+  that is backed by a file remains so.
+ */
+template<typename T>
+class MappedArray {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "MappedArray values are copied as bytes");
+
+public:
+  MappedArray() : num_values(0) { }
+
+  MappedArray(std::size_t size, const T& value) : num_values(0) {
+    assign(size, value);
+  }
+
+  MappedArray(const MappedArray& other) : num_values(0) {
+    *this = other;
+  }
+
+  MappedArray& operator=(const MappedArray& other) {
+    if(&other != this) {
+      reserve(other.num_values);
+      if(other.num_values) {
+        std::memcpy(buffer.data(), other.buffer.data(), other.num_values*sizeof(T));
+      }
+      num_values = other.num_values;
+    }
+    return *this;
+  }
+
+  MappedArray(MappedArray&& other)
+    : buffer(std::move(other.buffer)), num_values(other.num_values) {
+    other.num_values = 0;
+  }
+
+  MappedArray& operator=(MappedArray&& other) {
+    buffer = std::move(other.buffer);
+    num_values = other.num_values;
+    other.num_values = 0;
+    return *this;
+  }
+
+  void map_file(const std::string& path) { buffer.map_file(path); }
+  bool is_file_backed() const { return buffer.is_file_backed(); }
+
+  T* data() { return static_cast<T*>(buffer.data()); }
+  const T* data() const { return static_cast<const T*>(buffer.data()); }
+  T& operator[](std::size_t i) { return data()[i]; }
+  const T& operator[](std::size_t i) const { return data()[i]; }
+  T* begin() { return data(); }
+  T* end() { return data() + num_values; }
+  const T* begin() const { return data(); }
+  const T* end() const { return data() + num_values; }
+
+  std::size_t size() const { return num_values; }
+  bool empty() const { return num_values == 0; }
+
+  /// Resize the array, with any new values zero-filled
+  void resize(std::size_t size) {
+    reserve(size);
+    if(size > num_values) {
+      std::memset(static_cast<void*>(data() + num_values), 0, (size - num_values)*sizeof(T));
+    }
+    num_values = size;
+  }
+
+  void assign(std::size_t size, const T& value) {
+    resize(size);
+    for(std::size_t i=0; i<size; i++) {
+      data()[i] = value;
+    }
+  }
+
+  void push_back(const T& value) {
+    resize(num_values + 1);
+    data()[num_values-1] = value;
+  }
+
+  void clear() { resize(0); }
+
+private:
+  void reserve(std::size_t size) {
+    if(size*sizeof(T) > buffer.capacity()) {
+      // Grow geometrically, so that push_back is amortized O(1).
+      std::size_t capacity = buffer.capacity() / sizeof(T);
+      buffer.reserve(std::max(size, 2*capacity)*sizeof(T));
+    }
+  }
+
+  MappedBuffer buffer;
+  std::size_t num_values;
+};
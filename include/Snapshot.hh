@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <type_traits>
+
+/// Writes the values of a binary snapshot, in order
+/*
+  Values are written as their in-memory bytes, so arrays of nodes
+  can be written, and later read, as a single block.  Snapshots can
+  only be read on a machine with the same byte order and layout.
+ */
+class SnapshotWriter {
+public:
+  SnapshotWriter(std::ostream& out) : out(out) { }
+
+  template<typename T>
+  void write(const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Snapshot values are written as bytes");
+    write_bytes(&value, sizeof(T));
+  }
+
+  void write_string(const std::string& value);
+  void write_bytes(const void* data, std::size_t num_bytes);
+
+private:
+  std::ostream& out;
+};
+
+/// Reads a binary snapshot from a read-only memory map of the file
+/*
+  Blocks of values are returned as pointers into the map, so they can
+  be copied out directly, without being parsed.  A read past the end
+  of the file throws std::runtime_error.
+ */
+class SnapshotReader {
+public:
+  SnapshotReader(const std::string& path);
+  /// Read a snapshot that is already in memory, which must outlive the reader
+  SnapshotReader(const void* data, std::size_t num_bytes);
+  ~SnapshotReader();
+
+  SnapshotReader(const SnapshotReader&) = delete;
+  SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+  template<typename T>
+  T read() {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Snapshot values are read as bytes");
+    T value;
+    std::memcpy(&value, read_bytes(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  std::string read_string();
+  /// Returns the next num_bytes of the file, valid while the reader exists
+  const void* read_bytes(std::size_t num_bytes);
+  /// Number of bytes not yet read
+  std::size_t remaining() const { return num_bytes - pos; }
+
+  /// Throws std::runtime_error if the magic number is not next
+  void expect(std::uint64_t magic, const std::string& description);
+
+private:
+  const char* base;
+  std::size_t num_bytes;
+  std::size_t pos;
+  bool mapped;
+};
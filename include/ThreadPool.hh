@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// A fixed set of worker threads, used to run data-parallel loops
+/*
+  The calling thread takes part in each loop, so a pool of N threads
+  starts only N-1 workers.  Calls to parallel_for from several threads
+  are serialized.
+ */
+class ThreadPool {
+public:
+  ThreadPool(unsigned int num_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  unsigned int get_num_threads() const { return workers.size() + 1; }
+
+  /// Calls func(i) for every i in [0, num_tasks), returning once all are done.
+  void parallel_for(std::size_t num_tasks,
+                    const std::function<void(std::size_t)>& func);
+
+private:
+  void worker_thread();
+  void run_tasks(const std::function<void(std::size_t)>& func,
+                 std::size_t num_tasks);
+
+  std::vector<std::thread> workers;
+
+  std::mutex caller_mutex;
+
+  std::mutex task_mutex;
+  std::condition_variable task_cv;
+  std::condition_variable done_cv;
+  bool running;
+  std::uint64_t generation;
+  const std::function<void(std::size_t)>* current_func;
+  std::size_t num_tasks;
+  std::atomic<std::size_t> next_task;
+  std::size_t tasks_done;
+  unsigned int active_workers;
+};
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+/// A square field of tiles that may hold food, of size 8^num_layers
+/*
+  The interface shared by the storage backends of the food.
+  GrassyBitfield stores the tiles in a sparse tree, whose cost is
+  proportional to the boundaries between filled and empty regions.
+  DenseBitfield stores one bit per tile, whose cost is proportional to
+  the area, and which is faster for small or heavily fragmented
+  fields.  Each backend gives identical results for the same sequence
+  of operations.
+ */
+class TileField {
+public:
+  struct Location {
+    std::uint32_t x;
+    std::uint32_t y;
+  };
+
+  struct TileUpdate {
+    std::uint32_t x;
+    std::uint32_t y;
+    bool value;
+  };
+
+  virtual ~TileField() { }
+
+  virtual std::uint32_t get_size() const = 0;
+  virtual unsigned int get_num_layers() const = 0;
+  virtual bool get_edge_wrap() const = 0;
+  virtual std::uint64_t num_filled() const = 0;
+
+  virtual bool get_val(std::uint32_t x, std::uint32_t y, unsigned int plane=0) const = 0;
+  virtual void set_val(std::uint32_t x, std::uint32_t y, bool val, unsigned int plane=0) = 0;
+  /// Equivalent to calling set_val for each update, in order
+  virtual void apply_updates(const std::vector<TileUpdate>& updates) = 0;
+  /// Replace the contents with the listed filled tiles
+  virtual void load_tiles(const std::vector<Location>& tiles) = 0;
+
+  /// Find the filled tile whose center is nearest to (x,y)
+  /*
+    Only tiles whose center is strictly within the radius are
+    considered.  Distances wrap around the edges if edge wrapping is
+    enabled.  If several tiles are equally near, the one with the
+    lowest y, then the lowest x, is returned.  Returns nothing if no
+    such tile is filled.
+   */
+  virtual std::optional<Location> find_nearest_set(double x, double y, double radius) const = 0;
+
+  /// Spread food from each filled tile to its four neighbors
+  virtual void growth_iteration() = 0;
+
+protected:
+  /// State of a search for the nearest filled tile
+  struct NearestSearch {
+    double x;
+    double y;
+    double size;
+    bool edge_wrap;
+
+    double best_dist2;
+    std::optional<Location> best;
+
+    // Distance along one axis from pos to the interval [low, high].
+    double axis_dist(double pos, double low, double high) const {
+      if(!edge_wrap) {
+        if(pos < low) {
+          return low - pos;
+        } else if (pos > high) {
+          return pos - high;
+        } else {
+          return 0;
+        }
+      }
+
+      // Position relative to the start of the interval, in [0,size).
+      double rel = std::fmod(pos - low + size, size);
+      double width = high - low;
+      if(rel <= width) {
+        return 0;
+      }
+      return std::min(rel - width, size - rel);
+    }
+
+    // Largest distance along one axis from pos to the interval [low, high].
+    double axis_max_dist(double pos, double low, double high) const {
+      if(!edge_wrap) {
+        return std::max(std::abs(pos - low), std::abs(pos - high));
+      }
+
+      // The farthest point is directly opposite, if within the interval.
+      double opposite = std::fmod(pos + size/2 - low + size, size);
+      if(opposite <= high - low) {
+        return size/2;
+      }
+      return std::max(axis_dist(pos, low, low), axis_dist(pos, high, high));
+    }
+
+    double region_dist2(double x_min, double y_min, double width) const {
+      double dx = axis_dist(x, x_min, x_min + width);
+      double dy = axis_dist(y, y_min, y_min + width);
+      return dx*dx + dy*dy;
+    }
+
+    // True if a region at this distance may hold a tile that would be
+    // chosen.  Tiles as near as the best so far may still win a tie.
+    bool may_improve(double dist2) const {
+      return dist2 < best_dist2 || (best && dist2 == best_dist2);
+    }
+
+    // The tile in [low, low+width) whose center is nearest to pos.
+    // If two are equally near, the lower is returned.
+    std::uint32_t axis_nearest(double pos, std::uint32_t low, std::uint32_t width) const {
+      if(!edge_wrap) {
+        double tile = std::ceil(pos) - 1;
+        if(tile < low) {
+          return low;
+        } else if (tile > low + width - 1.0) {
+          return low + width - 1;
+        } else {
+          return std::uint32_t(tile);
+        }
+      }
+
+      double rel = std::fmod(pos - low + size, size);
+      if(rel < width) {
+        return rel > 0 ? low + std::uint32_t(std::ceil(rel)) - 1 : low;
+      }
+      double dist_high = rel - (width - 0.5);
+      double dist_low = size - rel + 0.5;
+      return dist_high < dist_low ? low + width - 1 : low;
+    }
+
+    void consider(std::uint32_t tile_x, std::uint32_t tile_y) {
+      double dx = axis_dist(x, tile_x + 0.5, tile_x + 0.5);
+      double dy = axis_dist(y, tile_y + 0.5, tile_y + 0.5);
+      double dist2 = dx*dx + dy*dy;
+      if(dist2 < best_dist2 ||
+         (best && dist2 == best_dist2 &&
+          std::tie(tile_y, tile_x) < std::tie(best->y, best->x))) {
+        best_dist2 = dist2;
+        best = Location{tile_x, tile_y};
+      }
+    }
+  };
+};
@@ -9,10 +9,10 @@
 #include <thread>
 
 #include "nlohmann/json.hpp"
+#include "GrassyBitfield.hh"
+#include "WorldSim.hh"
 using nlohmann::json;
 
-class WorldSim;
-
 struct ServerResponse {
   std::string response;
   std::string broadcast;
@@ -24,11 +24,32 @@ class WorldController {
     std::string command;
     std::weak_ptr<void> requested_by;
   };
+
+  /// A response, queued in order, whose JSON is built when it is sent
+  /*
+    Building the JSON of the world is the costly part of a response,
+    so the simulation thread only queues a frozen copy of the world,
+    and the JSON is built by the thread that calls update_check.
+   */
+  struct PendingResponse {
+    enum class Kind { Ready, Broadcast, FullMap, PastMap };
+    Kind kind;
+    /// The response itself if Ready, else only its recipient.
+    ServerResponse ready;
+    WorldSim::Frozen world;
+    std::uint64_t history_start;
+    /// For a Broadcast, true if the world was replaced since the last.
+    bool full_refresh;
+    /// For a PastMap, the error if the tick could not be reconstructed.
+    std::string history_error;
+  };
+
 public:
   WorldController(WorldSim& sim);
   ~WorldController();
 
   ServerResponse request(const std::string& command, std::weak_ptr<void> hdl);
+  /// The next queued response, to be called from a single thread
   ServerResponse update_check();
 
 private:
@@ -39,12 +60,33 @@ private:
 
   // To be called only from worker thread
   void broadcast_map_update();
-  json get_food_dist() const;
-  json get_creature_info() const;
+  PendingResponse get_past_map(std::uint64_t tick, std::weak_ptr<void> hdl) const;
   void reset_world();
 
+  // To be called only from the thread that calls update_check
+  ServerResponse build_response(PendingResponse& pending);
+
+  // May be called from any thread
+  static json get_food_dist(const GrassyBitfield::Frozen& food);
+  static json get_food_dist_since(const GrassyBitfield::Frozen& previous,
+                                  const GrassyBitfield::Frozen& food);
+  static json pack_food_fields(const std::vector<GrassyBitfield::DrawField>& fields);
+  static json get_creature_info(const std::vector<WorldSim::CreatureInfo>& creatures);
+  static json get_full_map(const WorldSim::Frozen& world, std::uint64_t history_start);
+  /// Queue a full map of the world as of the most recent broadcast
+  /*
+    Must be called with response_mutex held.
+   */
+  void queue_full_map(std::weak_ptr<void> hdl);
+
 
   WorldSim& sim;
+  /// True if the world has been replaced since the most recent
+  /// broadcast.  Only used by the worker thread.
+  bool world_replaced;
+  /// Food sent in the most recent broadcast.  Only used by the thread
+  /// that calls update_check.
+  GrassyBitfield::Frozen sent_food;
 
 
   std::atomic_bool worker_running;
@@ -55,5 +97,12 @@ private:
   std::queue<Request> worker_commands;
 
   std::mutex response_mutex;
-  std::queue<ServerResponse> responses;
+  std::queue<PendingResponse> responses;
+  /// The world as of the most recent broadcast, guarded by
+  /// response_mutex.  Replies made from it are queued with the
+  /// broadcasts, so that clients receive them in order.
+  WorldSim::Frozen broadcast_world;
+  /// Earliest tick in the history as of the most recent broadcast,
+  /// guarded by response_mutex.
+  std::uint64_t broadcast_history_start;
 };
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+#include "WorldSim.hh"
+
+/// A bounded record of the recent ticks of a WorldSim
+/*
+  The history is a ring of keyframes.  Each keyframe is a snapshot of
+  the whole world, as written by WorldSim::save, taken every
+  ticks_per_keyframe ticks.  Nothing is stored for the ticks between
+  keyframes.  They are reconstructed by loading the previous keyframe
+  and simulating forward, which gives exactly the same world, as the
+  simulation depends only on the state in the snapshot.
+
+  Storing the creatures of every tick would cost 40 bytes per creature
+  per tick, so that a world of 100k creatures could only keep a few
+  ticks.  Replaying instead costs up to ticks_per_keyframe-1
+  iterations for each seek.
+
+  A keyframe is also started when a setting that changes the
+  simulation is changed, so that no replay crosses it.  Once the
+  memory used exceeds the budget, the oldest keyframe is dropped.  The
+  most recent keyframe is always kept, even if it alone exceeds the
+  budget.
+ */
+class WorldSim::History {
+public:
+  static const std::uint64_t ticks_per_keyframe = 64;
+
+  History(std::size_t budget_bytes);
+
+  /// Record the state of the world after its current tick
+  /*
+    Ticks are expected in consecutive order.  A tick that does not
+    follow the previous one starts a new keyframe, and anything
+    recorded after it is dropped.
+   */
+  void record(const WorldSim& world);
+
+  /// Reconstruct the state of a tick
+  /*
+    Throws std::out_of_range if the tick is not held.
+   */
+  Frozen seek(std::uint64_t tick) const;
+
+  bool empty() const { return keyframes.empty(); }
+  /// The earliest tick that may be reconstructed
+  std::uint64_t first_tick() const;
+  /// The latest tick that may be reconstructed
+  std::uint64_t last_tick() const;
+
+  std::size_t get_budget() const { return budget_bytes; }
+  void set_budget(std::size_t budget_bytes);
+  std::size_t get_bytes_used() const { return bytes_used; }
+
+private:
+  struct Keyframe {
+    std::uint64_t first_tick;
+    /// Number of ticks, starting with first_tick, replayed from this
+    std::uint64_t num_ticks;
+    /// The settings_version of the world when the keyframe was taken
+    std::uint64_t settings_version;
+    /// The world, as written by WorldSim::save
+    std::string world;
+  };
+
+  static std::size_t keyframe_bytes(const Keyframe& keyframe);
+  void evict();
+
+  std::deque<Keyframe> keyframes;
+  std::size_t budget_bytes;
+  std::size_t bytes_used;
+};
@@ -1,36 +1,185 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <random>
+#include <string>
 #include <vector>
 
+#include "CreatureGrid.hh"
+#include "CreatureTable.hh"
+#include "DenseBitfield.hh"
 #include "GrassyBitfield.hh"
-#include "Creature.hh"
+
+class SnapshotReader;
+class SnapshotWriter;
+class ThreadPool;
 
 class WorldSim {
 public:
-  WorldSim(int num_layers, int random_seed = 0);
+  struct CreatureInfo {
+    GVector<2> position;
+    double direction;
+    double speed;
+    double radius;
+  };
+
+  /// An immutable copy of the world, which may be read from any thread
+  struct Frozen {
+    GrassyBitfield::Frozen food;
+    std::shared_ptr<const std::vector<CreatureInfo>> creatures;
+    std::uint64_t tick = 0;
+  };
+
+  class History;
+
+  /// Which backend runs growth and is read by the creatures
+  /*
+    The GrassyBitfield always holds the food that is drawn, frozen,
+    recorded in the history, and saved.  With Dense, a DenseBitfield
+    is also kept, and is used for growth and by the creatures.  The
+    tiles that change in it are copied into the GrassyBitfield at each
+    iteration.  Both give identical worlds.
+
+    Dense grows sparsely seeded worlds faster, but copying its changes
+    into the GrassyBitfield makes it slower for fragmented worlds,
+    where many blocks change at each growth.  Automatic therefore uses
+    Sparse, and Dense must be requested.
+   */
+  enum class FoodStorage { Automatic, Sparse, Dense };
+
+  /// Memory used by the history of past ticks, unless changed
+  static constexpr std::size_t default_history_budget = 64*1024*1024;
+
+  WorldSim(int num_layers, int random_seed = 0,
+           FoodStorage storage = FoodStorage::Automatic);
+  ~WorldSim();
+  WorldSim(WorldSim&& other);
+  WorldSim& operator=(WorldSim&& other);
 
   void iterate();
 
+  /// Write the world to a binary snapshot
+  /*
+    Includes the food, the creatures, and the state of the random
+    number generator, so a loaded world continues exactly as the
+    saved world would have.  The snapshot is written to a temporary
+    file, then renamed, so an existing snapshot at the path is only
+    replaced by a complete one.
+   */
+  void Save(const std::string& path) const;
+  static WorldSim Load(const std::string& path,
+                       FoodStorage storage = FoodStorage::Automatic);
+
   int GetSize() const { return food.get_size(); }
   int GetNumLayers() const { return food.get_num_layers(); }
 
   double GetFoodAt(int x, int y) const;
   std::vector<GrassyBitfield::DrawField> GetFoodDrawFields() const;
+  std::vector<GrassyBitfield::DrawField> GetFoodDrawFields(int x_min, int y_min,
+                                                           int x_max, int y_max,
+                                                           int min_tile_width) const;
+  GrassyBitfield::DrawFieldUpdate GetFoodDrawFieldsSince(std::uint64_t version) const;
 
   int GetIterationsPerGrowth() const { return iterations_per_growth; }
-  void SetIterationsPerGrowth(int new_rate) { iterations_per_growth = new_rate; }
+  void SetIterationsPerGrowth(int new_rate);
+
+  /// Sparse or Dense, as chosen when the world was created or loaded
+  FoodStorage GetFoodStorage() const;
+
+  int GetNumThreads() const { return food.get_num_threads(); }
+  /// Set the number of threads used to grow the food and update creatures
+  /*
+    Each creature draws random numbers from its own stream, so the
+    world does not depend on the number of threads.
+   */
+  void SetNumThreads(int num_threads);
 
-  const std::vector<Creature>& GetCreatures() { return creatures; }
+  const CreatureTable& GetCreatures() const { return creatures; }
+  /// Give creatures energy, births, and deaths
+  /*
+    Disabled by default.  See CreatureTable::set_lifecycle.
+   */
+  void SetCreatureLifecycle(bool enabled);
+  bool GetCreatureLifecycle() const { return creatures.get_lifecycle(); }
+  /// Index of the creatures by position, rebuilt at each iteration
+  /*
+    The cells are the size of two creatures, so that creatures that
+    touch are in the same or neighboring cells.
+   */
+  const CreatureGrid& GetCreatureGrid() const { return creature_grid; }
+  /// The food sensed by each creature, as in CreatureTable::sense_food
+  void SenseFood(double radius, std::vector<CreatureTable::FoodSense>& output) const;
+
+  /// Make a frozen copy of the current state
+  /*
+    The food shares every node that is unchanged with the previous
+    copy.  Every creature may move in each iteration, so the creatures
+    are copied.
+   */
+  Frozen Freeze();
+
+  /// Number of iterations since the world was created
+  std::uint64_t GetTick() const { return tick; }
+
+  /// Reconstruct the world as it was after a past tick
+  /*
+    Recent ticks are kept in a history whose memory use is limited by
+    the history budget.  Throws std::out_of_range if the tick is no
+    longer, or not yet, held.  The history starts when the world is
+    created or loaded.
+
+    Only every History::ticks_per_keyframe-th tick is stored, as a full
+    snapshot, and the ticks between are found by simulating forward
+    from it.  Each tick therefore costs 1/ticks_per_keyframe of a
+    snapshot, about 70 bytes per creature plus the food, and a seek
+    costs up to ticks_per_keyframe-1 iterations.
+   */
+  Frozen Seek(std::uint64_t tick) const;
+  /// The earliest tick that Seek can reconstruct
+  std::uint64_t GetHistoryStart() const;
+
+  std::size_t GetHistoryBudget() const;
+  /// Limit the memory used by the history, in bytes
+  void SetHistoryBudget(std::size_t bytes);
 
 private:
+  WorldSim(GrassyBitfield food, FoodStorage storage);
+
+  void save(SnapshotWriter& out) const;
+  /// Read a world written by save, without starting its history
+  static WorldSim load(SnapshotReader& in, FoodStorage storage);
+
+  void choose_food_storage(FoodStorage storage);
+
+  std::vector<CreatureInfo> creature_info() const;
+  void record_history();
+
   void initial_food_distribution();
   void initial_creature_generation();
+  void build_creature_grid();
 
   GrassyBitfield food;
+  /// Copy of food used for the simulation, if using dense storage.
+  std::unique_ptr<DenseBitfield> dense_food;
   int iterations_per_growth;
   int iterations_since_growth;
 
-  std::vector<Creature> creatures;
+  CreatureTable creatures;
+  CreatureGrid creature_grid;
+  /// Changes to the food made by creatures during the current iteration.
+  std::vector<GrassyBitfield::TileUpdate> food_updates;
+  /// Tiles filled by growth of dense_food, to be copied to food.
+  std::vector<GrassyBitfield::TileUpdate> growth_updates;
   std::mt19937 generator;
+  /// Seed of the random number streams of the creatures.
+  std::uint64_t creature_seed;
+  /// Incremented when a setting that changes the simulation is
+  /// changed, so that the history does not replay across it.
+  std::uint64_t settings_version;
+  std::shared_ptr<ThreadPool> thread_pool;
+
+  std::uint64_t tick;
+  std::unique_ptr<History> history;
 };
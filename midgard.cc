@@ -1,7 +1,10 @@
 #include <csignal>
 #include <chrono>
+#include <exception>
+#include <filesystem>
 #include <iostream>
 #include <sstream>
+#include <system_error>
 
 #include "WebServer.hh"
 #include "WorldSim.hh"
@@ -12,17 +15,51 @@ void signal_handler(int /*sig*/) {
   keep_running = 0;
 }
 
-int main() {
+// The world is saved here on shutdown, and continued from on startup.
+const char* snapshot_path = "midgard.snapshot";
+
+// A snapshot that cannot be read is moved here, and a new world started.
+const char* bad_snapshot_path = "midgard.snapshot.bad";
+
+WorldSim initial_world() {
+  if(std::filesystem::exists(snapshot_path)) {
+    try {
+      return WorldSim::Load(snapshot_path);
+    } catch(std::exception& e) {
+      // Any failure, including a header that asks for an impossible
+      // world, leaves the file for inspection rather than stopping
+      // the server from starting.
+      std::cerr << "Could not load " << snapshot_path << ": " << e.what() << "\n"
+                << "Moving it to " << bad_snapshot_path
+                << " and starting a new world" << std::endl;
+      std::error_code err;
+      std::filesystem::rename(snapshot_path, bad_snapshot_path, err);
+      if(err) {
+        std::cerr << "Could not move " << snapshot_path << ": " << err.message() << std::endl;
+      }
+    }
+  }
+
   WorldSim sim(2);
   sim.SetIterationsPerGrowth(20);
+  return sim;
+}
+
+int main() {
+  WorldSim sim = initial_world();
 
-  WebServer server(sim);
-  server.start(10101);
+  {
+    WebServer server(sim);
+    server.start(10101);
 
-  std::signal(SIGINT, signal_handler);
-  std::signal(SIGTERM, signal_handler);
+    std::signal(SIGINT, signal_handler);
+    std::signal(SIGTERM, signal_handler);
 
-  while(keep_running) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    while(keep_running) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
   }
+
+  // The server has stopped, so the world is no longer changing.
+  sim.Save(snapshot_path);
 }
@@ -0,0 +1,268 @@
+#include "BitfieldNodePool.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "Hash.hh"
+#include "Snapshot.hh"
+
+namespace {
+  const std::size_t initial_num_slots = 64;
+}
+
+BitfieldNodePool::BitfieldNodePool(unsigned int num_extra_planes)
+  : num_extra_planes(num_extra_planes),
+    slots(initial_num_slots, Slot{0, npos}), num_nodes(0) { }
+
+std::size_t BitfieldNodePool::slot_for(std::uint64_t key) const {
+  // Morton keys have long runs of zero bits at the bottom, and only
+  // differ in the upper bits for nearby nodes.  Mix them before using
+  // them to select a slot.
+  return mix64(key) & (slots.size() - 1);
+}
+
+BitfieldNodePool::index_t BitfieldNodePool::find(std::uint64_t key) const {
+  auto mask = slots.size() - 1;
+  for(auto i = slot_for(key); slots[i].index != npos; i = (i+1) & mask) {
+    if(slots[i].key == key) {
+      return slots[i].index;
+    }
+  }
+  return npos;
+}
+
+BitfieldNodePool::index_t BitfieldNodePool::insert(std::uint64_t key) {
+  auto existing = find(key);
+  if(existing != npos) {
+    return existing;
+  }
+
+  // Keep the load factor at most 1/2, so that probe sequences stay short.
+  if(2*(num_nodes+1) > slots.size()) {
+    rehash(2*slots.size());
+  }
+
+  index_t index;
+  if(free_list.size()) {
+    index = free_list.back();
+    free_list.pop_back();
+  } else {
+    index = nodes.size();
+    nodes.resize(nodes.size() + 1);
+    planes.resize(planes.size() + num_extra_planes);
+  }
+  nodes[index] = {key, Bitfield(0), 0, 0, 0, false, {0, 0, 0}, {npos, npos, npos, npos}, 0};
+  std::fill(extra_planes(index), extra_planes(index) + num_extra_planes, Bitfield(0));
+
+  auto mask = slots.size() - 1;
+  auto i = slot_for(key);
+  while(slots[i].index != npos) {
+    i = (i+1) & mask;
+  }
+  slots[i] = {key, index};
+  num_nodes++;
+
+  return index;
+}
+
+void BitfieldNodePool::erase(std::uint64_t key) {
+  auto mask = slots.size() - 1;
+  auto i = slot_for(key);
+  while(slots[i].index != npos && slots[i].key != key) {
+    i = (i+1) & mask;
+  }
+  if(slots[i].index == npos) {
+    return;
+  }
+
+  free_list.push_back(slots[i].index);
+  slots[i].index = npos;
+  num_nodes--;
+
+  // Backward-shift deletion.  Any later entry in the same run whose
+  // home slot is not between the hole and itself would no longer be
+  // reachable, and must be moved into the hole.
+  for(auto j = (i+1) & mask; slots[j].index != npos; j = (j+1) & mask) {
+    auto home = slot_for(slots[j].key);
+    bool reachable = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+    if(!reachable) {
+      slots[i] = slots[j];
+      slots[j].index = npos;
+      i = j;
+    }
+  }
+}
+
+void BitfieldNodePool::clear() {
+  nodes.clear();
+  planes.clear();
+  free_list.clear();
+  slots.assign(initial_num_slots, Slot{0, npos});
+  num_nodes = 0;
+}
+
+void BitfieldNodePool::rehash(std::size_t new_num_slots) {
+  std::vector<Slot> old_slots(new_num_slots, Slot{0, npos});
+  std::swap(old_slots, slots);
+
+  auto mask = slots.size() - 1;
+  for(const auto& slot : old_slots) {
+    if(slot.index != npos) {
+      auto i = slot_for(slot.key);
+      while(slots[i].index != npos) {
+        i = (i+1) & mask;
+      }
+      slots[i] = slot;
+    }
+  }
+}
+
+void BitfieldNodePool::map_to_files(const std::string& path) {
+  nodes.map_file(path + ".nodes");
+  planes.map_file(path + ".planes");
+}
+
+void BitfieldNodePool::sort_by_key() {
+  // order[i] is the current index of the node that moves to index i.
+  // Unused entries of the arena are placed after every node, and are
+  // then dropped.
+  std::vector<index_t> order;
+  order.reserve(nodes.size());
+  for(const auto& slot : slots) {
+    if(slot.index != npos) {
+      order.push_back(slot.index);
+    }
+  }
+  std::sort(order.begin(), order.end(),
+            [this](index_t a, index_t b) { return nodes[a].key < nodes[b].key; });
+  order.insert(order.end(), free_list.begin(), free_list.end());
+
+  std::vector<index_t> new_index(nodes.size());
+  for(index_t i=0; i<order.size(); i++) {
+    new_index[order[i]] = i;
+  }
+
+  // Apply the permutation one cycle at a time, so that no second copy
+  // of the arena is needed.
+  std::vector<bool> placed(nodes.size(), false);
+  std::vector<Bitfield> held_planes(num_extra_planes);
+  for(index_t start=0; start<order.size(); start++) {
+    if(placed[start]) {
+      continue;
+    }
+
+    auto held = nodes[start];
+    std::copy(extra_planes(start), extra_planes(start) + num_extra_planes,
+              held_planes.begin());
+    auto i = start;
+    while(order[i] != start) {
+      nodes[i] = nodes[order[i]];
+      std::copy(extra_planes(order[i]), extra_planes(order[i]) + num_extra_planes,
+                extra_planes(i));
+      placed[i] = true;
+      i = order[i];
+    }
+    nodes[i] = held;
+    std::copy(held_planes.begin(), held_planes.end(), extra_planes(i));
+    placed[i] = true;
+  }
+
+  nodes.resize(num_nodes);
+  planes.resize(num_nodes*num_extra_planes);
+  free_list.clear();
+
+  for(auto& node : nodes) {
+    for(auto& neighbor : node.neighbors) {
+      if(neighbor != npos) {
+        neighbor = new_index[neighbor];
+      }
+    }
+  }
+  for(auto& slot : slots) {
+    if(slot.index != npos) {
+      slot.index = new_index[slot.index];
+    }
+  }
+}
+
+bool BitfieldNodePool::is_sorted() const {
+  if(free_list.size()) {
+    return false;
+  }
+  for(std::size_t i=1; i<nodes.size(); i++) {
+    if(nodes[i-1].key >= nodes[i].key) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void BitfieldNodePool::save(SnapshotWriter& out) const {
+  if(!is_sorted()) {
+    BitfieldNodePool sorted = *this;
+    sorted.sort_by_key();
+    sorted.save(out);
+    return;
+  }
+
+  out.write<std::uint32_t>(sizeof(Node));
+  out.write<std::uint32_t>(num_extra_planes);
+  out.write<std::uint64_t>(num_nodes);
+  out.write_bytes(nodes.data(), num_nodes*sizeof(Node));
+  out.write_bytes(planes.data(), num_nodes*num_extra_planes*sizeof(Bitfield));
+}
+
+void BitfieldNodePool::load(SnapshotReader& in) {
+  auto node_size = in.read<std::uint32_t>();
+  auto extra_planes = in.read<std::uint32_t>();
+  if(node_size != sizeof(Node) || extra_planes != num_extra_planes) {
+    throw std::runtime_error("Snapshot nodes have a different layout");
+  }
+  // Checked before multiplying, so that a corrupt size cannot
+  // overflow into a small one.
+  auto size = in.read<std::uint64_t>();
+  auto bytes_per_node = sizeof(Node) + num_extra_planes*sizeof(Bitfield);
+  if(size > in.remaining()/bytes_per_node || size >= npos) {
+    throw std::runtime_error("Snapshot is truncated");
+  }
+  auto node_data = in.read_bytes(size*sizeof(Node));
+  auto plane_data = in.read_bytes(size*num_extra_planes*sizeof(Bitfield));
+
+  nodes.resize(size);
+  planes.resize(size*num_extra_planes);
+  if(size) {
+    std::memcpy(static_cast<void*>(nodes.data()), node_data, size*sizeof(Node));
+  }
+  if(size && num_extra_planes) {
+    std::memcpy(static_cast<void*>(planes.data()), plane_data,
+                size*num_extra_planes*sizeof(Bitfield));
+  }
+  free_list.clear();
+  num_nodes = size;
+
+  // Same load factor as insert() would give.
+  std::size_t num_slots = initial_num_slots;
+  while(2*(num_nodes+1) > num_slots) {
+    num_slots *= 2;
+  }
+  slots.assign(num_slots, Slot{0, npos});
+  auto mask = slots.size() - 1;
+  for(index_t index=0; index<num_nodes; index++) {
+    for(auto neighbor : nodes[index].neighbors) {
+      if(neighbor != npos && neighbor >= num_nodes) {
+        throw std::runtime_error("Snapshot has a link to a node that does not exist");
+      }
+    }
+
+    auto key = nodes[index].key;
+    auto i = slot_for(key);
+    while(slots[i].index != npos) {
+      if(slots[i].key == key) {
+        throw std::runtime_error("Snapshot has two nodes with the same key");
+      }
+      i = (i+1) & mask;
+    }
+    slots[i] = {key, index};
+  }
+}
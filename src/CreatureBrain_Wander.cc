@@ -1,16 +1,28 @@
 #include "CreatureBrain_Wander.hh"
 
-CreatureAction CreatureBrain_Wander::choose_action(std::mt19937& gen) {
-  std::uniform_real_distribution<> dis(0,1);
-  double rand = dis(gen);
+#include <limits>
+#include <random>
 
-  if(rand < 0.30) {
-    return CreatureAction::SpeedUp;
-  } else if (rand < 0.45) {
-    return CreatureAction::TurnLeft;
-  } else if (rand < 0.60) {
-    return CreatureAction::TurnRight;
-  } else {
-    return CreatureAction::EatFood;
+CreatureAction CreatureBrain_Wander::choose_action(CounterRng& gen) {
+  CreatureAction action;
+  choose_actions(&gen, nullptr, 1, &action);
+  return action;
+}
+
+void CreatureBrain_Wander::choose_actions(CounterRng* gens, CreatureBrain* const*,
+                                          std::size_t num_brains, CreatureAction* actions) {
+  // Indexed by the number of thresholds passed, to avoid branching.
+  static const CreatureAction choices[] = {
+    CreatureAction::SpeedUp,   // rand < 0.30
+    CreatureAction::TurnLeft,  // rand < 0.45
+    CreatureAction::TurnRight, // rand < 0.60
+    CreatureAction::EatFood,
+  };
+
+  for(std::size_t i=0; i<num_brains; i++) {
+    // Same value as std::uniform_real_distribution<>(0,1), without
+    // constructing one for each creature.
+    double rand = std::generate_canonical<double, std::numeric_limits<double>::digits>(gens[i]);
+    actions[i] = choices[(rand >= 0.30) + (rand >= 0.45) + (rand >= 0.60)];
   }
 }
@@ -0,0 +1,185 @@
+#include "CreatureGrid.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+#include "CreatureTable.hh"
+
+namespace {
+  // Limit on the number of cells per creature, so that the cost of a
+  // rebuild depends on the number of creatures, and not on the size
+  // of the world.
+  const std::size_t max_cells_per_creature = 2;
+
+  double wrap_position(double pos, double world_size) {
+    pos = std::fmod(pos, world_size);
+    if(pos < 0) {
+      pos += world_size;
+    }
+    // Rounding can give world_size for tiny negative values.
+    return (pos >= world_size) ? 0.0 : pos;
+  }
+
+  std::int64_t wrap_cell(std::int64_t cell, std::int64_t cells_per_side) {
+    return (cell % cells_per_side + cells_per_side) % cells_per_side;
+  }
+}
+
+CreatureGrid::CreatureGrid()
+  : world_size(1), cell_size(1), cells_per_side(1), cell_start(2, 0) { }
+
+void CreatureGrid::build(const CreatureTable& creatures, double world_size, double cell_size) {
+  if(world_size <= 0 || cell_size <= 0) {
+    throw std::invalid_argument("world_size and cell_size must be positive");
+  }
+
+  auto num_creatures = creatures.size();
+  auto max_cells = std::max<std::size_t>(1, max_cells_per_creature*num_creatures);
+  auto max_cells_per_side = std::max<std::size_t>(1, std::sqrt(double(max_cells)));
+  auto wanted_cells_per_side = std::max(1.0, std::floor(world_size/cell_size));
+
+  this->world_size = world_size;
+  cells_per_side = std::min<double>(wanted_cells_per_side, max_cells_per_side);
+  this->cell_size = world_size / cells_per_side;
+
+  // Counting sort by cell.  Creatures are visited in order, so each
+  // cell holds its creatures in order of index.
+  auto num_cells = std::size_t(cells_per_side)*cells_per_side;
+  cell_start.assign(num_cells + 1, 0);
+  cells.resize(num_creatures);
+  for(std::size_t i=0; i<num_creatures; i++) {
+    auto pos = creatures.get_position(i);
+    cells[i] = cell_of(pos.Y())*cells_per_side + cell_of(pos.X());
+    cell_start[cells[i] + 1]++;
+  }
+  for(std::size_t c=0; c<num_cells; c++) {
+    cell_start[c+1] += cell_start[c];
+  }
+
+  entries.resize(num_creatures);
+  for(std::size_t i=0; i<num_creatures; i++) {
+    auto pos = creatures.get_position(i);
+    // cell_start[c] is advanced past each entry, then restored below.
+    entries[cell_start[cells[i]]++] = {pos.X(), pos.Y(), std::uint32_t(i)};
+  }
+  for(std::size_t c=num_cells; c>0; c--) {
+    cell_start[c] = cell_start[c-1];
+  }
+  cell_start[0] = 0;
+}
+
+std::uint32_t CreatureGrid::cell_of(double pos) const {
+  pos = wrap_position(pos, world_size);
+  return std::min<std::uint32_t>(pos / cell_size, cells_per_side - 1);
+}
+
+double CreatureGrid::axis_dist(double a, double b) const {
+  double dist = std::abs(a - b);
+  return std::min(dist, world_size - dist);
+}
+
+double CreatureGrid::dist2(const Entry& entry, double x, double y) const {
+  double dx = axis_dist(entry.x, x);
+  double dy = axis_dist(entry.y, y);
+  return dx*dx + dy*dy;
+}
+
+void CreatureGrid::within_radius(double x, double y, double radius,
+                                 std::vector<std::uint32_t>& output) const {
+  if(entries.empty() || radius < 0) {
+    return;
+  }
+
+  x = wrap_position(x, world_size);
+  y = wrap_position(y, world_size);
+  double radius2 = radius*radius;
+
+  // Range of cells on each axis, covering each cell only once if the
+  // radius reaches around the world.
+  auto cell_range = [&](double pos) {
+    std::int64_t low = std::floor((pos - radius)/cell_size);
+    std::int64_t high = std::floor((pos + radius)/cell_size);
+    if(high - low + 1 >= cells_per_side) {
+      low = 0;
+      high = cells_per_side - 1;
+    }
+    return std::make_pair(low, high);
+  };
+  auto x_range = cell_range(x);
+  auto y_range = cell_range(y);
+
+  auto first_output = output.size();
+  for(auto cell_y = y_range.first; cell_y <= y_range.second; cell_y++) {
+    auto row = wrap_cell(cell_y, cells_per_side)*cells_per_side;
+    for(auto cell_x = x_range.first; cell_x <= x_range.second; cell_x++) {
+      auto cell = row + wrap_cell(cell_x, cells_per_side);
+      for(auto i=cell_start[cell]; i<cell_start[cell+1]; i++) {
+        if(dist2(entries[i], x, y) <= radius2) {
+          output.push_back(entries[i].creature);
+        }
+      }
+    }
+  }
+  std::sort(output.begin() + first_output, output.end());
+}
+
+void CreatureGrid::nearest(double x, double y, std::size_t k,
+                           std::vector<std::uint32_t>& output) const {
+  if(entries.empty() || k == 0) {
+    return;
+  }
+
+  x = wrap_position(x, world_size);
+  y = wrap_position(y, world_size);
+  std::int64_t center_x = cell_of(x);
+  std::int64_t center_y = cell_of(y);
+
+  // Offsets from the center cell, on each axis, that reach each cell
+  // exactly once.
+  std::int64_t min_offset = -std::int64_t(cells_per_side - 1)/2;
+  std::int64_t max_offset = cells_per_side/2;
+
+  // Max-heap of the best so far, by distance then by index.
+  std::vector<std::pair<double, std::uint32_t>> best;
+  auto visit_cell = [&](std::int64_t offset_x, std::int64_t offset_y) {
+    auto cell = (wrap_cell(center_y + offset_y, cells_per_side)*cells_per_side +
+                 wrap_cell(center_x + offset_x, cells_per_side));
+    for(auto i=cell_start[cell]; i<cell_start[cell+1]; i++) {
+      std::pair<double, std::uint32_t> candidate(dist2(entries[i], x, y), entries[i].creature);
+      if(best.size() < k) {
+        best.push_back(candidate);
+        std::push_heap(best.begin(), best.end());
+      } else if(candidate < best.front()) {
+        std::pop_heap(best.begin(), best.end());
+        best.back() = candidate;
+        std::push_heap(best.begin(), best.end());
+      }
+    }
+  };
+
+  // Visit rings of cells outward from the center.  Every point in a
+  // cell of ring r+1 is at least r*cell_size away, so the search stops
+  // once the k-th best is nearer than that.
+  for(std::int64_t ring=0; ring<=std::max(-min_offset, max_offset); ring++) {
+    for(auto offset_y = std::max(-ring, min_offset); offset_y <= std::min(ring, max_offset); offset_y++) {
+      bool edge_row = (offset_y == -ring || offset_y == ring);
+      for(auto offset_x = std::max(-ring, min_offset); offset_x <= std::min(ring, max_offset); offset_x++) {
+        if(edge_row || offset_x == -ring || offset_x == ring) {
+          visit_cell(offset_x, offset_y);
+        }
+      }
+    }
+
+    double next_ring_dist = ring*cell_size;
+    if(best.size() == k && best.front().first < next_ring_dist*next_ring_dist) {
+      break;
+    }
+  }
+
+  std::sort_heap(best.begin(), best.end());
+  for(const auto& entry : best) {
+    output.push_back(entry.second);
+  }
+}
@@ -0,0 +1,490 @@
+#include "CreatureTable.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <tuple>
+#include <typeinfo>
+
+#include "CreatureBrain.hh"
+#include "CreatureBrain_Wander.hh"
+#include "GrassyBitfield.hh"
+#include "Hash.hh"
+#include "Snapshot.hh"
+#include "ThreadPool.hh"
+
+namespace{
+  const double acceleration = 0.1;
+  const double turn_speed = 10 * (3.1415926/180);
+  const double speed_decay = 0.95;
+  const double creature_radius = 4;
+
+  // Creatures are updated in batches of this size, so that each batch
+  // is large enough to be worth sending to another thread.  The
+  // batches do not depend on the number of threads.
+  const std::size_t creatures_per_batch = 4096;
+
+  // Energy of the lifecycle.  A wandering creature eats on 40% of
+  // iterations, so it gains energy only where food is plentiful.
+  const double starting_energy = 10;
+  const double food_energy = 1;
+  const double energy_per_iteration = 0.25;
+  // Creatures with this much energy split it with a child.
+  const double birth_energy = 20;
+
+  const std::uint32_t no_index = std::uint32_t(-1);
+
+  // Half of the width of each cone of sense_food.
+  const double sense_half_angle = 30 * (3.14159265358979323846/180);
+
+  // Moves the last element into index i, then removes the last.
+  template<typename T>
+  void move_last(std::vector<T>& vec, std::size_t i) {
+    if(i+1 != vec.size()) {
+      vec[i] = std::move(vec.back());
+    }
+    vec.pop_back();
+  }
+
+  std::unique_ptr<CreatureBrain> make_brain(const std::string& name) {
+    if(name == "Wander") {
+      return std::make_unique<CreatureBrain_Wander>();
+    }
+    throw std::runtime_error("Unknown creature brain: " + name);
+  }
+}
+
+CreatureTable::CreatureTable() : lifecycle(false) { }
+
+CreatureTable::~CreatureTable() { }
+
+CreatureTable::CreatureTable(CreatureTable&&) = default;
+CreatureTable& CreatureTable::operator=(CreatureTable&&) = default;
+
+CreatureTable::Id CreatureTable::add(std::unique_ptr<CreatureBrain> brain, GVector<2> position,
+                                     double direction, double speed) {
+  auto group = group_of(*brain);
+  auto i = spawn(std::move(brain), group, position.X(), position.Y(),
+                 std::cos(direction), std::sin(direction), speed, starting_energy);
+  return get_id(i);
+}
+
+std::size_t CreatureTable::spawn(std::unique_ptr<CreatureBrain> brain, std::uint32_t group,
+                                 double pos_x, double pos_y,
+                                 double direction_x, double direction_y,
+                                 double speed, double energy) {
+  std::uint32_t slot;
+  if(free_slots.empty()) {
+    slot = slot_generation.size();
+    slot_generation.push_back(0);
+    slot_index.push_back(no_index);
+  } else {
+    slot = free_slots.back();
+    free_slots.pop_back();
+  }
+
+  auto i = size();
+  slot_index[slot] = i;
+  x.push_back(pos_x);
+  y.push_back(pos_y);
+  dir_x.push_back(direction_x);
+  dir_y.push_back(direction_y);
+  this->speed.push_back(speed);
+  this->energy.push_back(energy);
+  slots.push_back(slot);
+  brains.push_back(std::move(brain));
+  brain_groups.push_back(group);
+  return i;
+}
+
+void CreatureTable::remove(std::size_t i) {
+  auto slot = slots[i];
+  slot_generation[slot]++;
+  slot_index[slot] = no_index;
+  free_slots.push_back(slot);
+  spare_brains[brain_groups[i]].push_back(std::move(brains[i]));
+
+  auto last = size() - 1;
+  if(i != last) {
+    slot_index[slots[last]] = i;
+  }
+  move_last(x, i);
+  move_last(y, i);
+  move_last(dir_x, i);
+  move_last(dir_y, i);
+  move_last(speed, i);
+  move_last(energy, i);
+  move_last(slots, i);
+  move_last(brains, i);
+  move_last(brain_groups, i);
+}
+
+std::uint32_t CreatureTable::group_of(const CreatureBrain& brain) {
+  std::type_index type = typeid(brain);
+  for(std::uint32_t group=0; group<brain_types.size(); group++) {
+    if(brain_types[group] == type) {
+      return group;
+    }
+  }
+  brain_types.push_back(type);
+  spare_brains.emplace_back();
+  return brain_types.size() - 1;
+}
+
+CreatureTable::Id CreatureTable::get_id(std::size_t i) const {
+  auto slot = slots[i];
+  return (Id(slot_generation[slot]) << 32) | slot;
+}
+
+std::optional<std::size_t> CreatureTable::find(Id id) const {
+  std::uint32_t slot = id;
+  std::uint32_t generation = id >> 32;
+  if(slot >= slot_generation.size() || slot_generation[slot] != generation ||
+     slot_index[slot] == no_index) {
+    return std::nullopt;
+  }
+  return slot_index[slot];
+}
+
+double CreatureTable::get_direction(std::size_t i) const {
+  return std::atan2(dir_y[i], dir_x[i]);
+}
+
+double CreatureTable::get_radius() {
+  return creature_radius;
+}
+
+void CreatureTable::update(std::uint64_t seed, std::uint64_t tick, const TileField& field,
+                           std::vector<TileField::TileUpdate>& field_updates,
+                           ThreadPool* pool) {
+  // No action depends on the position of another creature, so every
+  // action can be taken before any creature moves.
+  make_batches();
+  auto run_batch = [&](std::size_t i) {
+    update_batch(batches[i], seed, tick, field);
+  };
+  if(pool && batches.size() > 1) {
+    pool->parallel_for(batches.size(), run_batch);
+  } else {
+    for(std::size_t i=0; i<batches.size(); i++) {
+      run_batch(i);
+    }
+  }
+
+  resolve_claims(field_updates);
+  move(field.get_size(), pool);
+  if(lifecycle) {
+    births_and_deaths();
+  }
+}
+
+void CreatureTable::make_batches() {
+  // Counting sort of the creatures by brain type.  Creatures are
+  // visited in order, so each group holds its creatures in order.
+  auto num_groups = brain_types.size();
+  group_start.assign(num_groups + 1, 0);
+  for(auto group : brain_groups) {
+    group_start[group + 1]++;
+  }
+  for(std::size_t group=0; group<num_groups; group++) {
+    group_start[group + 1] += group_start[group];
+  }
+
+  order.resize(size());
+  ordered_brains.resize(size());
+  for(std::size_t i=0; i<size(); i++) {
+    // group_start is advanced past each creature, then restored below.
+    auto pos = group_start[brain_groups[i]]++;
+    order[pos] = i;
+    ordered_brains[pos] = brains[i].get();
+  }
+  for(std::size_t group=num_groups; group>0; group--) {
+    group_start[group] = group_start[group - 1];
+  }
+  group_start[0] = 0;
+
+  // Existing batches are reused, to keep their buffers.
+  std::size_t num_batches = 0;
+  for(std::size_t group=0; group<num_groups; group++) {
+    for(auto begin=group_start[group]; begin<group_start[group+1]; begin+=creatures_per_batch) {
+      if(num_batches == batches.size()) {
+        batches.emplace_back();
+      }
+      auto& batch = batches[num_batches++];
+      batch.group = group;
+      batch.begin = begin;
+      batch.end = std::min(begin + creatures_per_batch, group_start[group+1]);
+    }
+  }
+  batches.resize(num_batches);
+}
+
+void CreatureTable::update_batch(Batch& batch, std::uint64_t seed, std::uint64_t tick,
+                                 const TileField& field) {
+  auto num_creatures = batch.end - batch.begin;
+  const auto* creatures = order.data() + batch.begin;
+  auto* batch_brains = ordered_brains.data() + batch.begin;
+
+  batch.gens.clear();
+  auto tick_key = mix64(tick);
+  for(std::size_t j=0; j<num_creatures; j++) {
+    batch.gens.emplace_back(mix64(seed ^ mix64(get_id(creatures[j]) ^ tick_key)));
+  }
+
+  batch.actions.resize(num_creatures);
+  batch_brains[0]->choose_actions(batch.gens.data(), batch_brains,
+                                  num_creatures, batch.actions.data());
+
+  for(auto& list : batch.by_action) {
+    list.clear();
+  }
+  for(std::size_t j=0; j<num_creatures; j++) {
+    batch.by_action[std::size_t(batch.actions[j])].push_back(creatures[j]);
+  }
+
+  batch.claims.clear();
+  for(auto i : batch.by_action[std::size_t(CreatureAction::EatFood)]) {
+    eat_food(i, field, batch.claims);
+  }
+  for(auto i : batch.by_action[std::size_t(CreatureAction::TurnLeft)]) {
+    turn(i, +get_turn_angle(i));
+  }
+  for(auto i : batch.by_action[std::size_t(CreatureAction::TurnRight)]) {
+    turn(i, -get_turn_angle(i));
+  }
+  for(auto i : batch.by_action[std::size_t(CreatureAction::SpeedUp)]) {
+    change_speed(i, +acceleration);
+  }
+  for(auto i : batch.by_action[std::size_t(CreatureAction::SlowDown)]) {
+    change_speed(i, -acceleration);
+  }
+}
+
+void CreatureTable::resolve_claims(std::vector<TileField::TileUpdate>& field_updates) {
+  claims.clear();
+  for(const auto& batch : batches) {
+    claims.insert(claims.end(), batch.claims.begin(), batch.claims.end());
+  }
+
+  // Sorted by tile, then by creature, so that the first claim of each
+  // tile is the one that succeeds.
+  std::sort(claims.begin(), claims.end(), [](const FoodClaim& a, const FoodClaim& b) {
+      return std::tie(a.y, a.x, a.creature) < std::tie(b.y, b.x, b.creature);
+    });
+  for(std::size_t i=0; i<claims.size(); i++) {
+    if(i == 0 || claims[i].x != claims[i-1].x || claims[i].y != claims[i-1].y) {
+      field_updates.push_back({claims[i].x, claims[i].y, false});
+      if(lifecycle) {
+        energy[claims[i].creature] += food_energy;
+      }
+    }
+  }
+}
+
+void CreatureTable::move(double world_size, ThreadPool* pool) {
+  auto num_batches = (size() + creatures_per_batch - 1)/creatures_per_batch;
+  auto move_batch = [&](std::size_t i) {
+    move_range(i*creatures_per_batch, std::min(size(), (i+1)*creatures_per_batch), world_size);
+  };
+  if(pool && num_batches > 1) {
+    pool->parallel_for(num_batches, move_batch);
+  } else {
+    move_range(0, size(), world_size);
+  }
+}
+
+void CreatureTable::move_range(std::size_t begin, std::size_t end, double world_size) {
+  double* pos_x = x.data();
+  double* pos_y = y.data();
+  const double* direction_x = dir_x.data();
+  const double* direction_y = dir_y.data();
+  double* speeds = speed.data();
+
+  // No branches or calls, so that the loop is vectorized.  Without
+  // -ffast-math, comparisons of doubles are not vectorized, so the
+  // position is wrapped by truncating to an int instead.  Shifting by
+  // world_size first keeps the value positive, as it moved less than
+  // world_size.
+  for(std::size_t i=begin; i<end; i++) {
+    double shifted_x = pos_x[i] + speeds[i]*direction_x[i] + world_size;
+    double shifted_y = pos_y[i] + speeds[i]*direction_y[i] + world_size;
+    int wraps_x = shifted_x/world_size;
+    int wraps_y = shifted_y/world_size;
+    double new_x = shifted_x - world_size*wraps_x;
+    double new_y = shifted_y - world_size*wraps_y;
+    pos_x[i] = new_x;
+    pos_y[i] = new_y;
+    speeds[i] *= speed_decay;
+  }
+}
+
+void CreatureTable::sense_food(const GrassyBitfield& food, double radius,
+                               std::vector<FoodSense>& output, ThreadPool* pool) const {
+  output.resize(size());
+  // Area of each cone, counting each tile center as one unit.
+  double cone_area = sense_half_angle*radius*radius;
+
+  auto sense_batch = [&](std::size_t batch) {
+    auto end = std::min(size(), (batch+1)*creatures_per_batch);
+    for(auto i=batch*creatures_per_batch; i<end; i++) {
+      double direction = get_direction(i);
+      auto cone = [&](double offset) {
+        if(cone_area <= 0) {
+          return 0.0;
+        }
+        auto count = food.count_in_sector(x[i], y[i], radius, direction + offset,
+                                          sense_half_angle);
+        return std::min(1.0, count / cone_area);
+      };
+      output[i].left = cone(+2*sense_half_angle);
+      output[i].center = cone(0);
+      output[i].right = cone(-2*sense_half_angle);
+      output[i].ahead = food.cast_ray(x[i], y[i], direction, radius).value_or(radius);
+    }
+  };
+
+  auto num_batches = (size() + creatures_per_batch - 1)/creatures_per_batch;
+  if(pool && num_batches > 1) {
+    pool->parallel_for(num_batches, sense_batch);
+  } else {
+    for(std::size_t batch=0; batch<num_batches; batch++) {
+      sense_batch(batch);
+    }
+  }
+}
+
+void CreatureTable::births_and_deaths() {
+  parents.clear();
+  dead.clear();
+  for(std::size_t i=0; i<size(); i++) {
+    energy[i] -= energy_per_iteration;
+    if(energy[i] >= birth_energy) {
+      parents.push_back(i);
+    } else if(energy[i] <= 0) {
+      dead.push_back(i);
+    }
+  }
+
+  // Each child starts where its parent is, facing the other way.
+  for(auto parent : parents) {
+    energy[parent] /= 2;
+    auto group = brain_groups[parent];
+    std::unique_ptr<CreatureBrain> brain;
+    if(spare_brains[group].empty()) {
+      brain = brains[parent]->make_child();
+    } else {
+      brain = std::move(spare_brains[group].back());
+      spare_brains[group].pop_back();
+    }
+    spawn(std::move(brain), group, x[parent], y[parent],
+          -dir_x[parent], -dir_y[parent], 0, energy[parent]);
+  }
+
+  // Removed from the highest index down, so that each creature moved
+  // into place by a removal is one that is still alive.
+  for(auto it = dead.rbegin(); it != dead.rend(); it++) {
+    remove(*it);
+  }
+}
+
+void CreatureTable::turn(std::size_t i, double delta_angle) {
+  // Rotate the direction directly, rather than converting it to an
+  // angle and back.
+  double c = std::cos(delta_angle);
+  double s = std::sin(delta_angle);
+  double old_x = dir_x[i];
+  double old_y = dir_y[i];
+  dir_x[i] = c*old_x - s*old_y;
+  dir_y[i] = s*old_x + c*old_y;
+}
+
+double CreatureTable::get_turn_angle(std::size_t i) const {
+  return turn_speed / std::max(1.0, speed[i]);
+}
+
+void CreatureTable::change_speed(std::size_t i, double delta_v) {
+  speed[i] = std::max(0.0, speed[i] + delta_v);
+}
+
+void CreatureTable::eat_food(std::uint32_t i, const TileField& field,
+                             std::vector<FoodClaim>& claims) const {
+  auto food = field.find_nearest_set(x[i], y[i], creature_radius);
+  if(food) {
+    claims.push_back({food->x, food->y, i});
+  }
+}
+
+void CreatureTable::save(SnapshotWriter& out) const {
+  out.write<std::uint8_t>(lifecycle);
+  out.write<std::uint64_t>(size());
+  for(std::size_t i=0; i<size(); i++) {
+    out.write_string(brains[i]->get_name());
+    out.write(x[i]);
+    out.write(y[i]);
+    out.write(dir_x[i]);
+    out.write(dir_y[i]);
+    out.write(speed[i]);
+    out.write(energy[i]);
+    out.write(slots[i]);
+  }
+
+  // The free slots are saved in order, so that a loaded table gives
+  // new creatures the same ids.
+  out.write<std::uint64_t>(slot_generation.size());
+  for(auto generation : slot_generation) {
+    out.write(generation);
+  }
+  out.write<std::uint64_t>(free_slots.size());
+  for(auto slot : free_slots) {
+    out.write(slot);
+  }
+}
+
+CreatureTable CreatureTable::load(SnapshotReader& in, bool with_lifecycle) {
+  CreatureTable table;
+  if(with_lifecycle) {
+    table.lifecycle = in.read<std::uint8_t>();
+  }
+
+  auto num_creatures = in.read<std::uint64_t>();
+  for(std::uint64_t i=0; i<num_creatures; i++) {
+    auto brain = make_brain(in.read_string());
+    table.brain_groups.push_back(table.group_of(*brain));
+    table.brains.push_back(std::move(brain));
+    table.x.push_back(in.read<double>());
+    table.y.push_back(in.read<double>());
+    table.dir_x.push_back(in.read<double>());
+    table.dir_y.push_back(in.read<double>());
+    table.speed.push_back(in.read<double>());
+    table.energy.push_back(with_lifecycle ? in.read<double>() : starting_energy);
+    table.slots.push_back(with_lifecycle ? in.read<std::uint32_t>() : i);
+  }
+
+  if(with_lifecycle) {
+    table.slot_generation.resize(in.read<std::uint64_t>());
+    for(auto& generation : table.slot_generation) {
+      generation = in.read<std::uint32_t>();
+    }
+    table.free_slots.resize(in.read<std::uint64_t>());
+    for(auto& slot : table.free_slots) {
+      slot = in.read<std::uint32_t>();
+    }
+  } else {
+    table.slot_generation.assign(num_creatures, 0);
+  }
+
+  table.slot_index.assign(table.slot_generation.size(), no_index);
+  for(std::size_t i=0; i<num_creatures; i++) {
+    auto slot = table.slots[i];
+    if(slot >= table.slot_index.size() || table.slot_index[slot] != no_index) {
+      throw std::runtime_error("Invalid creature slot in snapshot");
+    }
+    table.slot_index[slot] = i;
+  }
+  for(auto slot : table.free_slots) {
+    if(slot >= table.slot_index.size() || table.slot_index[slot] != no_index) {
+      throw std::runtime_error("Invalid free creature slot in snapshot");
+    }
+  }
+  return table;
+}
@@ -0,0 +1,303 @@
+#include "DenseBitfield.hh"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+DenseBitfield::DenseBitfield(unsigned int num_layers, bool initial_value, bool edge_wrap)
+  : num_layers(num_layers), edge_wrap(edge_wrap), population(0) {
+
+  if(num_layers < 1) {
+    throw std::invalid_argument("num_layers must be at least 1");
+  }
+
+  // 8^6 tiles on a side would need 8 GB.
+  if(num_layers > 5) {
+    throw std::invalid_argument("num_layers can be at most 5 for a DenseBitfield");
+  }
+
+  size = 1UL << (3*num_layers);
+  words_per_row = (size + 63)/64;
+  last_word_mask = (size%64) ? (1ULL << (size%64)) - 1 : ~0ULL;
+
+  words.assign(std::size_t(size)*words_per_row, 0);
+  empty_row.assign(words_per_row, 0);
+  if(initial_value) {
+    for(std::uint32_t y=0; y<size; y++) {
+      std::fill(row(y), row(y) + words_per_row, ~0ULL);
+      row(y)[words_per_row-1] = last_word_mask;
+    }
+    population = std::uint64_t(size)*size;
+  }
+}
+
+DenseBitfield::DenseBitfield(const TileField& other)
+  : DenseBitfield(other.get_num_layers(), false, other.get_edge_wrap()) {
+  for(std::uint32_t y=0; y<size; y++) {
+    for(std::uint32_t x=0; x<size; x++) {
+      if(other.get_val(x, y)) {
+        row(y)[x/64] |= 1ULL << (x%64);
+        population++;
+      }
+    }
+  }
+}
+
+bool DenseBitfield::wrap(std::uint32_t& x, std::uint32_t& y) const {
+  if((x >= size || y >= size) && !edge_wrap) {
+    return false;
+  }
+
+  // Same wrapping as GrassyBitfield::get_address_wrap.
+  x = (x + size) % size;
+  y = (y + size) % size;
+  return true;
+}
+
+void DenseBitfield::check_plane(unsigned int plane) const {
+  if(plane != 0) {
+    throw std::invalid_argument("plane is out of range");
+  }
+}
+
+bool DenseBitfield::get_val(std::uint32_t x, std::uint32_t y, unsigned int plane) const {
+  check_plane(plane);
+  if(!wrap(x, y)) {
+    return false;
+  }
+  return (row(y)[x/64] >> (x%64)) & 1;
+}
+
+void DenseBitfield::set_val(std::uint32_t x, std::uint32_t y, bool val, unsigned int plane) {
+  check_plane(plane);
+  auto original_x = x;
+  auto original_y = y;
+  if(!wrap(x, y)) {
+    std::stringstream ss;
+    ss << "Tile (" << original_x << ", " << original_y << ") is off the edge";
+    throw std::invalid_argument(ss.str());
+  }
+
+  auto& word = row(y)[x/64];
+  auto bit = 1ULL << (x%64);
+  if(bool(word & bit) != val) {
+    word ^= bit;
+    if(val) {
+      population++;
+    } else {
+      population--;
+    }
+  }
+}
+
+void DenseBitfield::apply_updates(const std::vector<TileUpdate>& updates) {
+  // Checked before any are applied, as in GrassyBitfield.
+  for(auto update : updates) {
+    if(!wrap(update.x, update.y)) {
+      std::stringstream ss;
+      ss << "Tile (" << update.x << ", " << update.y << ") is off the edge";
+      throw std::invalid_argument(ss.str());
+    }
+  }
+
+  for(const auto& update : updates) {
+    set_val(update.x, update.y, update.value);
+  }
+}
+
+void DenseBitfield::load_tiles(const std::vector<Location>& tiles) {
+  for(auto tile : tiles) {
+    if(!wrap(tile.x, tile.y)) {
+      std::stringstream ss;
+      ss << "Tile (" << tile.x << ", " << tile.y << ") is off the edge";
+      throw std::invalid_argument(ss.str());
+    }
+  }
+
+  std::fill(words.begin(), words.end(), 0);
+  population = 0;
+  for(const auto& tile : tiles) {
+    set_val(tile.x, tile.y, true);
+  }
+}
+
+std::optional<TileField::Location> DenseBitfield::find_nearest_set(
+  double x, double y, double radius) const {
+  NearestSearch search;
+  search.size = size;
+  search.edge_wrap = edge_wrap;
+  if(edge_wrap) {
+    x = std::fmod(std::fmod(x, search.size) + search.size, search.size);
+    y = std::fmod(std::fmod(y, search.size) + search.size, search.size);
+  }
+  search.x = x;
+  search.y = y;
+  search.best_dist2 = radius*radius;
+
+  // Rows are visited outward from y, so the search stops at the first
+  // pair of rows that are both farther than the best tile so far.
+  // Tiles as near as the best are still considered, so that the
+  // tie-breaking of consider() gives the same tile as GrassyBitfield.
+  std::int64_t center = std::floor(std::max(-1.0, std::min(y, double(size))));
+  std::int64_t max_offset = edge_wrap ? size/2 + 1 : size + 1;
+  for(std::int64_t offset=0; offset<=max_offset; offset++) {
+    bool any_row = false;
+    for(auto tile_y : {center - offset, center + offset}) {
+      if(edge_wrap) {
+        tile_y = (tile_y % size + size) % size;
+      } else if(tile_y < 0 || tile_y >= size) {
+        continue;
+      }
+
+      double dy = search.axis_dist(y, tile_y + 0.5, tile_y + 0.5);
+      if(search.may_improve(dy*dy)) {
+        any_row = true;
+        nearest_in_row(tile_y, search);
+      }
+    }
+
+    if(!any_row && offset > 0) {
+      break;
+    }
+  }
+
+  return search.best;
+}
+
+void DenseBitfield::nearest_in_row(std::uint32_t tile_y, NearestSearch& search) const {
+  // The nearest filled tile is the first one found in either
+  // direction from x.
+  const auto* words = row(tile_y);
+  std::int64_t center = std::floor(std::max(-1.0, std::min(search.x, double(size))));
+  std::int64_t left = center - 1;
+  if(edge_wrap) {
+    left = (left + size) % size;
+  }
+
+  if(center < size) {
+    auto tile_x = next_set(words, std::max<std::int64_t>(center, 0));
+    if(tile_x != size) {
+      search.consider(tile_x, tile_y);
+    }
+  }
+  if(left >= 0) {
+    auto tile_x = prev_set(words, std::min<std::int64_t>(left, size - 1));
+    if(tile_x != size) {
+      search.consider(tile_x, tile_y);
+    }
+  }
+}
+
+std::uint32_t DenseBitfield::next_set(const std::uint64_t* words, std::uint32_t start) const {
+  auto w = start/64;
+  auto bits = words[w] & (~0ULL << (start%64));
+  while(true) {
+    if(bits) {
+      return 64*w + __builtin_ctzll(bits);
+    }
+    w++;
+    if(w == words_per_row) {
+      break;
+    }
+    bits = words[w];
+  }
+
+  // Continue from the other edge, up to the starting word.
+  if(edge_wrap) {
+    for(w=0; w<=start/64; w++) {
+      if(words[w]) {
+        return 64*w + __builtin_ctzll(words[w]);
+      }
+    }
+  }
+  return size;
+}
+
+std::uint32_t DenseBitfield::prev_set(const std::uint64_t* words, std::uint32_t start) const {
+  auto w = start/64;
+  auto bits = words[w] & (~0ULL >> (63 - start%64));
+  while(true) {
+    if(bits) {
+      return 64*w + 63 - __builtin_clzll(bits);
+    }
+    if(w == 0) {
+      break;
+    }
+    w--;
+    bits = words[w];
+  }
+
+  if(edge_wrap) {
+    for(w=words_per_row; w-- > start/64; ) {
+      if(words[w]) {
+        return 64*w + 63 - __builtin_clzll(words[w]);
+      }
+    }
+  }
+  return size;
+}
+
+void DenseBitfield::grow_row(std::uint32_t y, std::uint64_t* output) const {
+  // Rows off the edge, if not wrapping, are treated as empty.
+  const std::uint64_t* above = (y > 0) ? row(y-1) : (edge_wrap ? row(size-1) : empty_row.data());
+  const std::uint64_t* below = (y+1 < size) ? row(y+1) : (edge_wrap ? row(0) : empty_row.data());
+  const std::uint64_t* current = row(y);
+
+  // The bits carried in to each end of the row from the other end.
+  auto last = words_per_row - 1;
+  auto top_bit = (size-1) % 64;
+  std::uint64_t wrap_low = edge_wrap ? (current[last] >> top_bit) & 1 : 0;
+  std::uint64_t wrap_high = edge_wrap ? current[0] & 1 : 0;
+
+  if(words_per_row == 1) {
+    auto value = current[0];
+    output[0] = (value | (value << 1) | wrap_low | (value >> 1) | (wrap_high << top_bit) |
+                 above[0] | below[0]) & last_word_mask;
+    return;
+  }
+
+  output[0] = (current[0] | (current[0] << 1) | wrap_low |
+               (current[0] >> 1) | (current[1] << 63) |
+               above[0] | below[0]);
+  // Interior words have no special cases, so that the loop can be
+  // vectorized.
+  for(std::uint32_t w=1; w<last; w++) {
+    output[w] = (current[w] | (current[w] << 1) | (current[w-1] >> 63) |
+                 (current[w] >> 1) | (current[w+1] << 63) |
+                 above[w] | below[w]);
+  }
+  output[last] = (current[last] | (current[last] << 1) | (current[last-1] >> 63) |
+                  (current[last] >> 1) | (wrap_high << top_bit) |
+                  above[last] | below[last]);
+}
+
+void DenseBitfield::growth_iteration() {
+  next_words.resize(words.size());
+  for(std::uint32_t y=0; y<size; y++) {
+    grow_row(y, next_words.data() + std::size_t(y)*words_per_row);
+  }
+
+  // Growth only fills tiles.
+  for(std::size_t i=0; i<words.size(); i++) {
+    population += __builtin_popcountll(next_words[i] & ~words[i]);
+  }
+  std::swap(words, next_words);
+}
+
+void DenseBitfield::growth_iteration(std::vector<TileUpdate>& new_tiles) {
+  growth_iteration();
+
+  for(std::uint32_t y=0; y<size; y++) {
+    const auto* current = row(y);
+    const auto* previous = next_words.data() + std::size_t(y)*words_per_row;
+    for(std::uint32_t w=0; w<words_per_row; w++) {
+      auto bits = current[w] & ~previous[w];
+      while(bits) {
+        auto loc = __builtin_ctzll(bits);
+        bits &= bits - 1;
+        new_tiles.push_back({64*w + loc, y, true});
+      }
+    }
+  }
+}
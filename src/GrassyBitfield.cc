@@ -1,11 +1,69 @@
 #include "GrassyBitfield.hh"
 
-#include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <stdexcept>
 #include <sstream>
 
+#include "Hash.hh"
+#include "Snapshot.hh"
+#include "ThreadPool.hh"
+
 namespace {
+// Below this many blocks, dividing growth between threads costs more
+// than it saves.  Finding the growth of a block takes about 0.2 us,
+// so this is about 200 us of work, well above the cost of waking the
+// workers.
+const std::size_t min_parallel_frontier = 1024;
+
+// The change log is trimmed once it is longer than this, and longer
+// than twice the number of nodes.  Beyond that, a full refresh costs
+// about the same as the list of changes.
+const std::size_t min_change_log_length = 4096;
+
+// Below this many iterations, growth_iterations steps one at a time,
+// rather than converting to and from a quadtree.
+const std::uint64_t min_memoized_iterations = 8;
+
+// Limit on the size of the growth memo, after which it is discarded.
+const std::size_t max_memoized_nodes = 1 << 22;
+
+// Identifies a GrassyBitfield snapshot, and the version of its format.
+const std::uint64_t snapshot_magic = 0x444c454946535247; // "GRSFIELD"
+const std::uint32_t snapshot_version = 1;
+
+// Number of bits of precision in the growth probability.  Each bit
+// costs one random word per mask.
+const unsigned int growth_probability_bits = 8;
+const std::uint32_t full_growth_threshold = 1 << growth_probability_bits;
+
+// Returns a word where each bit is set with probability
+// threshold/full_growth_threshold.  Each random word has bits set
+// with probability 1/2.  Combining a mask with another random word
+// by AND halves the probability, and by OR averages it with 1, so
+// applying the bits of the threshold from lowest to highest gives
+// the threshold in binary.
+std::bitset<64> random_mask(std::uint64_t state, std::uint64_t stream,
+                            std::uint32_t threshold) {
+  if(threshold >= full_growth_threshold) {
+    return std::bitset<64>(-1L);
+  }
+
+  std::uint64_t mask = 0;
+  for(unsigned int i=0; i<growth_probability_bits; i++) {
+    if(mask == 0 && !((threshold >> i) & 1)) {
+      continue;
+    }
+    auto word = mix64(state + (stream*growth_probability_bits + i)*0x9e3779b97f4a7c15ULL);
+    mask = ((threshold >> i) & 1) ? (mask | word) : (mask & word);
+  }
+  return mask;
+}
+
 std::uint64_t get_address(std::uint32_t x, std::uint32_t y) {
   // Interleave every 3 bits of x and y.  Every 3 bits gives the
   // coordinate in a given layer.  This every 6 bit chunk as a
@@ -16,8 +74,8 @@ std::uint64_t get_address(std::uint32_t x, std::uint32_t y) {
     unsigned int coordinate_bits = 3*i;
     unsigned int x_bits = 6*i;
     unsigned int y_bits = 6*i + 3;
-    output |= ((x >> coordinate_bits) & 7) << x_bits;
-    output |= ((y >> coordinate_bits) & 7) << y_bits;
+    output |= std::uint64_t((x >> coordinate_bits) & 7) << x_bits;
+    output |= std::uint64_t((y >> coordinate_bits) & 7) << y_bits;
   }
   return output;
 }
@@ -44,10 +102,24 @@ std::uint64_t get_bitfield_key(std::uint64_t address, unsigned int layer) {
   return address + (15 - layer);
 }
 
-std::uint64_t get_bitfield_key(std::uint32_t x, std::uint32_t y, unsigned int layer) {
-  return get_bitfield_key(get_address(x,y), layer);
+// Bits of an address that hold the x or y coordinate.
+const std::uint64_t x_address_bits = 0x01c71c71c71c71c7;
+const std::uint64_t y_address_bits = 0x0e38e38e38e38e38;
+
+// Offsets to the neighbors of a node, in the order of
+// BitfieldNodePool::Node::neighbors.  The opposite of direction i is
+// direction i^1.
+const int neighbor_offsets[4][2] = {{-1, 0}, {+1, 0}, {0, -1}, {0, +1}};
+
+unsigned int get_key_layer(std::uint64_t key) {
+  return 15 - (key & 15);
 }
 
+std::uint64_t get_parent_key(std::uint64_t key) {
+  // Returns the field one layer up that contains the given field.
+  // Assumes that the key given is not at the top layer.
+  return get_bitfield_key(key & 0xffffffffffffffc0, get_key_layer(key) + 1);
+}
 
 unsigned int get_bitfield_loc(std::uint64_t address, unsigned int layer) {
   // Location in layer 0 is in lowest 6 bits, and each successive
@@ -67,7 +139,7 @@ struct BitfieldKeyInfo{
 BitfieldKeyInfo unpack_bitfield_key(std::uint64_t key) {
   BitfieldKeyInfo output;
 
-  output.layer = 15 - (key & 15);
+  output.layer = get_key_layer(key);
   output.tile_width = 1 << (3*output.layer);
   output.field_width = 8*output.tile_width;
 
@@ -86,11 +158,28 @@ BitfieldKeyInfo unpack_bitfield_key(std::uint64_t key) {
   return output;
 }
 
+GrassyBitfield::DrawField make_draw_field(std::uint64_t key, GrassyBitfield::Bitfield bits) {
+  auto info = unpack_bitfield_key(key);
+
+  GrassyBitfield::DrawField field;
+  field.x_min = info.x_min;
+  field.y_min = info.y_min;
+  field.width = info.field_width;
+
+  for(unsigned int y=0; y<8; y++) {
+    for(unsigned int x=0; x<8; x++) {
+      field.values[y][x] = bits.test(8*y + x);
+    }
+  }
+
+  return field;
+}
+
 std::uint64_t get_subfield_key(std::uint64_t key, unsigned int loc) {
   // Returns the subfield of a field at a given location.
   // Assumes that the key given is not at layer 0.
   // Assumes that loc is in range [0,64).
-  auto layer = unpack_bitfield_key(key).layer;
+  auto layer = get_key_layer(key);
   // Add the segment of the address
   key |= std::uint64_t(loc) << (6*layer);
   // Increment the layer field, which decreases the layer by one,
@@ -102,8 +191,11 @@ std::uint64_t get_subfield_key(std::uint64_t key, unsigned int loc) {
 
 
 GrassyBitfield::GrassyBitfield(unsigned int num_layers, bool initial_value,
-                               bool edge_wrap)
-  : num_layers(num_layers), edge_wrap(edge_wrap) {
+                               bool edge_wrap, unsigned int num_planes)
+  : num_layers(num_layers), num_planes(num_planes), nodes(num_planes-1),
+    edge_wrap(edge_wrap), compacted_changed_blocks(0),
+    growth_threshold(full_growth_threshold), growth_seed(0), growth_generation(0),
+    version(0), forgotten_version(0), frozen_version(0) {
 
   if(num_layers < 1) {
     throw std::invalid_argument("num_layers must be at least 1");
@@ -116,14 +208,22 @@ GrassyBitfield::GrassyBitfield(unsigned int num_layers, bool initial_value,
     throw std::invalid_argument("num_layers can be at most 10");
   }
 
-  auto top_addr = get_bitfield_key(get_address(0,0), num_layers-1);
-  bitfields[top_addr] = initial_value ? -1L : 0;
+  if(num_planes < 1 || num_planes > max_planes) {
+    throw std::invalid_argument("num_planes must be between 1 and 4");
+  }
+
+  store_node(top_key(), initial_value ? -1L : 0);
+  update_population(0);
 }
 
 std::uint32_t GrassyBitfield::get_size() const {
   return 1UL << (3*num_layers);
 }
 
+std::uint64_t GrassyBitfield::top_key() const {
+  return get_bitfield_key(0, num_layers-1);
+}
+
 std::uint64_t GrassyBitfield::get_address_wrap(std::uint32_t x, std::uint32_t y) const {
   auto full_grid_size = this->get_size();
 
@@ -141,56 +241,319 @@ std::uint64_t GrassyBitfield::get_address_wrap(std::uint32_t x, std::uint32_t y)
   return get_address(x,y);
 }
 
+GrassyBitfield::index_t GrassyBitfield::find_stored(std::uint64_t key) const {
+  auto index = nodes.find(key);
+  if(index != BitfieldNodePool::npos && nodes[index].stored) {
+    return index;
+  }
+  return BitfieldNodePool::npos;
+}
+
+GrassyBitfield::index_t GrassyBitfield::lowest_stored_node(
+  std::uint64_t address, unsigned int min_layer) const {
+  // Walk down from the top-most layer, following the child masks.
+  // Every stored node has a chain of nodes leading to it from the
+  // top, so the walk can stop as soon as the chain ends, without
+  // looking up keys that do not exist.
+  auto index = nodes.find(top_key());
+  auto lowest = index;
+  for(unsigned int layer=num_layers-1; layer>min_layer; layer--) {
+    auto loc = get_bitfield_loc(address, layer);
+    if(!((nodes[index].child_mask >> loc) & 1)) {
+      break;
+    }
 
-bool GrassyBitfield::get_val(std::uint32_t x, std::uint32_t y) const {
-  auto address = get_address_wrap(x,y);
+    index = nodes.find(get_bitfield_key(address, layer-1));
+    if(nodes[index].stored) {
+      lowest = index;
+    }
+  }
 
-  // Start at the lowest possible layer, then walk up to the topmost layer.
-  for(unsigned int layer=0; layer<num_layers; layer++) {
-    auto key = get_bitfield_key(address, layer);
-    if(bitfields.count(key)) {
-      auto loc = get_bitfield_loc(address, layer);
-      return bitfields.at(key).test(loc);
+  return lowest;
+}
+
+void GrassyBitfield::store_node(std::uint64_t key, Bitfield bits) {
+  Planes planes = {};
+  planes[0] = bits;
+  store_node(key, planes);
+}
+
+void GrassyBitfield::store_node(std::uint64_t key, const Planes& planes) {
+  bool existed = (nodes.find(key) != BitfieldNodePool::npos);
+  auto index = nodes.insert(key);
+  nodes[index].stored = true;
+  for(unsigned int plane=0; plane<num_planes; plane++) {
+    plane_bits(index, plane) = planes[plane];
+  }
+  if(!existed) {
+    link_neighbors(index);
+  }
+  mark_dirty(key);
+
+  // Link the new node to its parents, creating pass-through nodes as
+  // needed, until reaching a parent that was already present.
+  for(auto layer = get_key_layer(key); layer+1 < num_layers; layer++) {
+    auto parent_key = get_parent_key(key);
+    auto loc = get_bitfield_loc(key, layer+1);
+
+    bool parent_existed = (nodes.find(parent_key) != BitfieldNodePool::npos);
+    auto parent_index = nodes.insert(parent_key);
+    nodes[parent_index].child_mask |= (1UL << loc);
+    if(parent_existed) {
+      break;
+    }
+    link_neighbors(parent_index);
+    key = parent_key;
+  }
+}
+
+GrassyBitfield::Bitfield& GrassyBitfield::plane_bits(index_t index, unsigned int plane) {
+  return plane ? nodes.extra_planes(index)[plane-1] : nodes[index].bits;
+}
+
+const GrassyBitfield::Bitfield& GrassyBitfield::plane_bits(index_t index,
+                                                           unsigned int plane) const {
+  return plane ? nodes.extra_planes(index)[plane-1] : nodes[index].bits;
+}
+
+unsigned int GrassyBitfield::level_at(index_t index, unsigned int loc) const {
+  unsigned int level = 0;
+  for(unsigned int plane=0; plane<num_planes; plane++) {
+    level |= unsigned(plane_bits(index, plane).test(loc)) << plane;
+  }
+  return level;
+}
+
+void GrassyBitfield::require_single_plane(const char* operation) const {
+  if(num_planes > 1) {
+    std::stringstream ss;
+    ss << operation << " requires a GrassyBitfield with a single plane";
+    throw std::logic_error(ss.str());
+  }
+}
+
+void GrassyBitfield::erase_node(std::uint64_t key) {
+  auto index = nodes.find(key);
+  nodes[index].stored = false;
+  mark_dirty(key);
+
+  // Remove the node, and any pass-through parents that no longer
+  // lead to a stored node.
+  auto top = top_key();
+  while(key != top &&
+        !nodes[index].stored &&
+        nodes[index].child_mask == 0) {
+    auto population = nodes[index].population;
+    unlink_neighbors(index);
+    nodes.erase(key);
+
+    auto layer = get_key_layer(key);
+    auto parent_key = get_parent_key(key);
+    auto loc = get_bitfield_loc(key, layer+1);
+    index = nodes.find(parent_key);
+    nodes[index].child_mask &= ~(1UL << loc);
+    nodes[index].child_population -= population;
+    key = parent_key;
+  }
+}
+
+void GrassyBitfield::link_neighbors(index_t index) {
+  // Edge wrapping is handled here, once, so that following a link
+  // needs no address arithmetic.
+  auto key = nodes[index].key;
+  for(unsigned int i=0; i<4; i++) {
+    auto neighbor_index = BitfieldNodePool::npos;
+    auto neighbor = neighbor_key(key, neighbor_offsets[i][0], neighbor_offsets[i][1]);
+    if(neighbor != -1UL) {
+      neighbor_index = nodes.find(neighbor);
     }
+
+    nodes[index].neighbors[i] = neighbor_index;
+    if(neighbor_index != BitfieldNodePool::npos) {
+      nodes[neighbor_index].neighbors[i^1] = index;
+    }
+  }
+}
+
+void GrassyBitfield::unlink_neighbors(index_t index) {
+  for(unsigned int i=0; i<4; i++) {
+    auto neighbor_index = nodes[index].neighbors[i];
+    if(neighbor_index != BitfieldNodePool::npos) {
+      nodes[neighbor_index].neighbors[i^1] = BitfieldNodePool::npos;
+    }
+  }
+}
+
+void GrassyBitfield::mark_dirty(std::uint64_t key) {
+  version++;
+  change_log.push_back({version, key});
+
+  // Forget the older half of the log once it has grown too long.
+  if(change_log.size() > min_change_log_length &&
+     change_log.size() > 2*nodes.size()) {
+    auto num_forgotten = change_log.size()/2;
+    forgotten_version = change_log[num_forgotten-1].version;
+    change_log.erase(change_log.begin(), change_log.begin() + num_forgotten);
+  }
+}
+
+void GrassyBitfield::mark_all_dirty() {
+  // Used after the nodes are rebuilt from scratch.  Every earlier
+  // version needs a full refresh.
+  version++;
+  change_log.clear();
+  forgotten_version = version;
+}
+
+bool GrassyBitfield::get_val(std::uint32_t x, std::uint32_t y, unsigned int plane) const {
+  if(plane >= num_planes) {
+    throw std::invalid_argument("plane is out of range");
+  }
+
+  auto address = get_address_wrap(x,y);
+  auto index = lowest_stored_node(address, 0);
+  auto layer = get_key_layer(nodes[index].key);
+  return plane_bits(index, plane).test(get_bitfield_loc(address, layer));
+}
+
+void GrassyBitfield::set_val(std::uint32_t x, std::uint32_t y, bool val, unsigned int plane) {
+  if(plane >= num_planes) {
+    throw std::invalid_argument("plane is out of range");
   }
 
-  // If nothing else, we should reach the topmost bitfield, and should
-  // never reach here.
-  assert(false);
+  auto address = get_address_wrap(x,y);
+  if(set_planes(address, unsigned(val) << plane, 1u << plane)) {
+    update_population(address);
+    mark_block_changed(get_bitfield_key(address, 0));
+  }
+}
+
+unsigned int GrassyBitfield::get_level(std::uint32_t x, std::uint32_t y) const {
+  auto address = get_address_wrap(x,y);
+  auto index = lowest_stored_node(address, 0);
+  auto layer = get_key_layer(nodes[index].key);
+  return level_at(index, get_bitfield_loc(address, layer));
 }
 
-void GrassyBitfield::set_val(std::uint32_t x, std::uint32_t y, bool val) {
+void GrassyBitfield::set_level(std::uint32_t x, std::uint32_t y, unsigned int level) {
+  if(level > all_planes()) {
+    throw std::invalid_argument("level is out of range");
+  }
+
   auto address = get_address_wrap(x,y);
-  set_val(address, val);
+  if(set_planes(address, level, all_planes())) {
+    update_population(address);
+    mark_block_changed(get_bitfield_key(address, 0));
+  }
+}
+
+void GrassyBitfield::apply_updates(const std::vector<TileUpdate>& updates) {
+  struct AddressUpdate {
+    std::uint64_t address;
+    bool value;
+  };
+
+  std::vector<AddressUpdate> sorted;
+  sorted.reserve(updates.size());
+  for(const auto& update : updates) {
+    auto address = get_address_wrap(update.x, update.y);
+    if(address == -1UL) {
+      std::stringstream ss;
+      ss << "Tile (" << update.x << ", " << update.y << ") is off the edge";
+      throw std::invalid_argument(ss.str());
+    }
+    sorted.push_back({address, update.value});
+  }
+
+  // A stable sort keeps repeated updates of a tile in order, so the
+  // last update is applied last.
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const AddressUpdate& a, const AddressUpdate& b) {
+                     return a.address < b.address;
+                   });
+
+  std::size_t i = 0;
+  while(i < sorted.size()) {
+    auto key = get_bitfield_key(sorted[i].address, 0);
+    auto old_bits = get_field(sorted[i].address, 0);
+    auto new_bits = old_bits;
+    for(; i<sorted.size() && get_bitfield_key(sorted[i].address, 0) == key; i++) {
+      new_bits.set(get_bitfield_loc(sorted[i].address, 0), sorted[i].value);
+    }
+
+    if(new_bits != old_bits) {
+      auto planes = get_planes(key, 0);
+      planes[0] = new_bits;
+      set_block(key, planes);
+      mark_block_changed(key);
+    }
+  }
+}
+
+void GrassyBitfield::mark_block_changed(std::uint64_t key) {
+  changed_blocks.push_back(key);
+
+  // If growth is not run, repeated changes to the same blocks would
+  // otherwise accumulate without limit.  Growth removes duplicates
+  // itself, so this does not change its result.
+  if(changed_blocks.size() > min_change_log_length &&
+     changed_blocks.size() > 2*compacted_changed_blocks) {
+    std::sort(changed_blocks.begin(), changed_blocks.end());
+    changed_blocks.erase(std::unique(changed_blocks.begin(), changed_blocks.end()),
+                         changed_blocks.end());
+    compacted_changed_blocks = changed_blocks.size();
+  }
 }
 
-void GrassyBitfield::set_val(std::uint64_t address, bool val) {
+bool GrassyBitfield::set_planes(std::uint64_t address, unsigned int level,
+                                unsigned int plane_mask, unsigned int first_layer) {
   // Walk up the layers, starting at the lowest level.  Loop concludes
   // if (a) a bitfield doesn't exists or (b) a bitfield exists and
-  // cannot be collapsed.
+  // cannot be collapsed.  Only the planes in plane_mask are set.
 
-  // This function is used both to set an arbitrary location, or to check
-  for(unsigned int layer=0; layer<num_layers; layer++) {
+  // Returns whether the value at first_layer was changed.
+  bool changed = false;
+  for(unsigned int layer=first_layer; layer<num_layers; layer++) {
     auto key = get_bitfield_key(address, layer);
-    if(bitfields.count(key)) {
-      // Set the bit that has been passed up from the previous level
-      auto& bitfield = bitfields[key];
-      bitfield.set(get_bitfield_loc(address, layer), val);
-
-      // If all the values are the same, pass the value to be set into
-      // the next iteration of the loop.
-      if(bitfield.all()) {
-        val = true;
-      } else if(bitfield.none()) {
-        val = false;
-      } else {
+    auto index = find_stored(key);
+    if(index != BitfieldNodePool::npos) {
+      // Set the bits that have been passed up from the previous level
+      auto loc = get_bitfield_loc(address, layer);
+      bool node_changed = false;
+      for(unsigned int plane=0; plane<num_planes; plane++) {
+        bool val = (level >> plane) & 1;
+        auto& bitfield = plane_bits(index, plane);
+        if(((plane_mask >> plane) & 1) && bitfield.test(loc) != val) {
+          bitfield.set(loc, val);
+          node_changed = true;
+        }
+      }
+      if(node_changed) {
+        mark_dirty(key);
+        changed = changed || (layer == first_layer);
+      }
+
+      // If all the values are the same in every plane, pass the
+      // values to be set into the next iteration of the loop.
+      bool uniform = true;
+      level = 0;
+      for(unsigned int plane=0; plane<num_planes && uniform; plane++) {
+        const auto& bitfield = plane_bits(index, plane);
+        if(bitfield.all()) {
+          level |= 1u << plane;
+        } else if(!bitfield.none()) {
+          uniform = false;
+        }
+      }
+      if(!uniform) {
         break;
       }
+      plane_mask = all_planes();
 
       // Top-most layer is allowed to be uniform, so that every
       // location always exists within some bitfield.
       if(layer != num_layers-1) {
-        bitfields.erase(key);
+        erase_node(key);
       }
     } else {
       // The bitfield doesn't already exist.  If whatever indirect
@@ -198,273 +561,1820 @@ void GrassyBitfield::set_val(std::uint64_t address, bool val) {
       // then we don't need to do anything.  Otherwise, we need to
       // make a new bitfield at the current layer.  The new bitfield
       // has the parent value for everything but the current loc.
-      bool current_val = false;
-      for(unsigned parent_layer = layer+1; parent_layer<num_layers; parent_layer++) {
-        auto parent_key = get_bitfield_key(address, parent_layer);
-        if(bitfields.count(parent_key)) {
-          auto parent_loc = get_bitfield_loc(address, parent_layer);
-          current_val = bitfields[parent_key].test(parent_loc);
-          break;
-        }
-      }
+      auto parent_index = lowest_stored_node(address, layer+1);
+      auto parent_layer = get_key_layer(nodes[parent_index].key);
+      auto parent_loc = get_bitfield_loc(address, parent_layer);
+      auto current_level = level_at(parent_index, parent_loc);
+      auto new_level = (current_level & ~plane_mask) | (level & plane_mask);
 
-      if(val != current_val) {
+      if(new_level != current_level) {
         auto loc = get_bitfield_loc(address, layer);
-        Bitfield new_field = current_val ? -1L : 0;
-        new_field.flip(loc);
-        bitfields[key] = new_field;
+        Planes new_planes = {};
+        for(unsigned int plane=0; plane<num_planes; plane++) {
+          new_planes[plane] = ((current_level >> plane) & 1) ? -1L : 0;
+          new_planes[plane].set(loc, (new_level >> plane) & 1);
+        }
+        store_node(key, new_planes);
+        changed = changed || (layer == first_layer);
       }
       break;
     }
   }
-}
 
-std::uint64_t GrassyBitfield::num_filled() const {
-  auto top_addr = get_bitfield_key(get_address(0,0), num_layers-1);
-  return num_filled(top_addr, true);
+  return changed;
 }
 
-std::uint64_t GrassyBitfield::num_filled(std::uint64_t key, bool parent_value) const {
-  // Determine map
-  Bitfield bitfield;
-  if(bitfields.count(key)) {
-    bitfield = bitfields.at(key);
-  } else {
-    bitfield = parent_value ? -1L : 0;
+void GrassyBitfield::set_block(std::uint64_t key, const Planes& planes) {
+  // Sets every value of a layer-0 block, giving the same structure as
+  // setting each value individually.
+  auto index = find_stored(key);
+  bool uniform = true;
+  unsigned int level = 0;
+  for(unsigned int plane=0; plane<num_planes; plane++) {
+    if(planes[plane].all()) {
+      level |= 1u << plane;
+    } else if(!planes[plane].none()) {
+      uniform = false;
+    }
   }
 
-  auto info = unpack_bitfield_key(key);
-
-  if(info.layer>0 && has_subfields(key)) {
-    // Bitfield has at least one subfield, loop and recurse into any subfields.
-    std::uint64_t output = 0;
-    for(unsigned int loc=0; loc<64; loc++) {
-      auto subfield_key = get_subfield_key(key, loc);
-      bool value = bitfield.test(loc);
-      if(exists_or_has_subfields(subfield_key)) {
-        output += num_filled(subfield_key, value);
-      } else {
-        output += std::uint64_t(value) << (6*info.layer);
+  if(!uniform || num_layers == 1) {
+    if(index == BitfieldNodePool::npos) {
+      store_node(key, planes);
+    } else {
+      for(unsigned int plane=0; plane<num_planes; plane++) {
+        plane_bits(index, plane) = planes[plane];
       }
+      mark_dirty(key);
     }
-    return output;
-
   } else {
-    // Bitfield has no subfields, count all set bits and return.
-    return bitfield.count() << (6*info.layer);
+    // A uniform block is held by the layer above.
+    if(index != BitfieldNodePool::npos) {
+      erase_node(key);
+    }
+    set_planes(key & 0xffffffffffffffc0, level, all_planes(), 1);
   }
-}
 
+  update_population(key);
+}
 
-void GrassyBitfield::growth_iteration() {
+void GrassyBitfield::update_population(std::uint64_t address) {
+  // Only the nodes containing the address can have changed.  Collect
+  // them from the top down, along with the value each inherits from
+  // its parents, then recount them from the bottom up.
+  index_t path[10];
+  bool inherited[10];
+  unsigned int path_length = 0;
+
+  auto index = nodes.find(top_key());
+  bool value = false;
+  while(true) {
+    path[path_length] = index;
+    inherited[path_length] = value;
+    path_length++;
+
+    const auto& node = nodes[index];
+    auto layer = get_key_layer(node.key);
+    auto loc = get_bitfield_loc(address, layer);
+    if(layer == 0 || !((node.child_mask >> loc) & 1)) {
+      break;
+    }
 
-  std::map<std::uint64_t, Bitfield> new_growth;
-  determine_new_growth(bitfields.begin()->first, false, new_growth);
+    if(node.stored) {
+      value = node.bits.test(loc);
+    }
+    index = nodes.find(get_bitfield_key(address, layer-1));
+  }
 
-  for(const auto& pair : new_growth) {
-    auto info = unpack_bitfield_key(pair.first);
-    if(pair.second.any()) {
-      auto& bitfield = bitfields[pair.first];
-      bitfield |= pair.second;
-      set_val(info.bottom_left_address, bitfield.test(0));
+  for(unsigned int i=path_length; i-- > 0; ) {
+    auto& node = nodes[path[i]];
+    Bitfield bitfield = node.stored ? node.bits : Bitfield(inherited[i] ? -1L : 0);
+    auto layer = get_key_layer(node.key);
+
+    auto population = (((bitfield & ~Bitfield(node.child_mask)).count() << (6*layer)) +
+                       node.child_population);
+    auto change = population - node.population;
+    node.population = population;
+    if(i > 0) {
+      nodes[path[i-1]].child_population += change;
     }
   }
 }
 
-void GrassyBitfield::determine_new_growth(
-  std::uint64_t key,
-  bool parent_value,
-  std::map<std::uint64_t, Bitfield>& output
-) const {
-  // Determine map
-  Bitfield bitfield;
-  if(bitfields.count(key)) {
-    bitfield = bitfields.at(key);
-  } else {
-    bitfield = parent_value ? -1L : 0;
+void GrassyBitfield::load_tiles(const std::vector<Location>& tiles) {
+  require_single_plane("load_tiles");
+
+  std::vector<std::uint64_t> addresses;
+  addresses.reserve(tiles.size());
+  for(const auto& tile : tiles) {
+    auto address = get_address_wrap(tile.x, tile.y);
+    if(address == -1UL) {
+      std::stringstream ss;
+      ss << "Tile (" << tile.x << ", " << tile.y << ") is off the edge";
+      throw std::invalid_argument(ss.str());
+    }
+    addresses.push_back(address);
+  }
+  std::sort(addresses.begin(), addresses.end());
+
+  // Sorted addresses have the tiles of each block next to each other.
+  std::vector<BlockUpdate> blocks;
+  for(auto address : addresses) {
+    auto key = get_bitfield_key(address, 0);
+    if(blocks.empty() || blocks.back().key != key) {
+      blocks.push_back({key, Bitfield(0)});
+    }
+    blocks.back().bits.set(get_bitfield_loc(address, 0));
   }
 
-  auto info = unpack_bitfield_key(key);
+  load_blocks(blocks);
+}
 
+void GrassyBitfield::load_raster(const std::vector<bool>& raster) {
+  require_single_plane("load_raster");
 
+  std::uint64_t size = get_size();
+  if(raster.size() != size*size) {
+    std::stringstream ss;
+    ss << "Raster has " << raster.size() << " values, "
+       << "but the field has " << size*size << " tiles";
+    throw std::invalid_argument(ss.str());
+  }
 
-  // Find the grid on the same level or higher that contains the
-  // specified point.
-  auto find_field = [&](std::uint32_t x, std::uint32_t y) {
-    auto address = get_address_wrap(x,y);
-    if(address==-1UL) {
-      return Bitfield(0);
-    }
-
-    for(unsigned int layer=info.layer; layer<this->num_layers; layer++) {
-      auto key = get_bitfield_key(address, layer);
-      if(bitfields.count(key)) {
-        if(layer == info.layer) {
-          // Adjacent field is on same layer, return bitfield as is.
-          return bitfields.at(key);
-        } else {
-          // Adjacent field is on higher layer, return full/empty
-          // bitfield.
-          auto loc = get_bitfield_loc(address, layer);
-          bool value = bitfields.at(key).test(loc);
-          return Bitfield(value ? -1L : 0);
-        }
-      }
+  // Visit each block in order of increasing Morton key.
+  std::vector<BlockUpdate> blocks;
+  std::uint64_t num_blocks = 1UL << (6*(num_layers-1));
+  for(std::uint64_t i=0; i<num_blocks; i++) {
+    auto key = get_bitfield_key(i << 6, 0);
+    auto info = unpack_bitfield_key(key);
+
+    Bitfield bits;
+    for(unsigned int loc=0; loc<64; loc++) {
+      auto x = info.x_min + loc%8;
+      auto y = info.y_min + loc/8;
+      bits.set(loc, raster[y*size + x]);
     }
+    if(bits.any()) {
+      blocks.push_back({key, bits});
+    }
+  }
 
-    assert(false);
-  };
+  load_blocks(blocks);
+}
 
-  auto needs_recursion = [&](std::uint64_t key) {
-    // Recursion is needed if the bitfield exists, or if any of its
-    // subfields exists, or if any of its neighbors' subfields exist.
-    auto info = unpack_bitfield_key(key);
-    auto left_field = get_bitfield_key(get_address_wrap(info.x_min-1,
-                                                        info.y_min),
-                                       info.layer);
-    auto right_field = get_bitfield_key(get_address_wrap(info.x_min+info.field_width,
-                                                         info.y_min),
-                                        info.layer);
-    auto down_field = get_bitfield_key(get_address_wrap(info.x_min,
-                                                        info.y_min+info.field_width),
-                                       info.layer);
-    auto up_field = get_bitfield_key(get_address_wrap(info.x_min,info.y_min-1),
-                                     info.layer);
-    return (exists_or_has_subfields(key) ||
-            (left_field!=-1UL && exists_or_has_subfields(left_field)) ||
-            (right_field!=-1UL && exists_or_has_subfields(right_field)) ||
-            (up_field!=-1UL && exists_or_has_subfields(up_field)) ||
-            (down_field!=-1UL && exists_or_has_subfields(down_field)));
-  };
+void GrassyBitfield::load_blocks(const std::vector<BlockUpdate>& blocks) {
+  // Builds the same structure as setting each filled tile in an
+  // empty field, as in build_from_quadtree.  The blocks must be
+  // sorted by key, and must each have at least one filled tile.
+  // Since the keys are sorted, the fields sharing a parent are next
+  // to each other, and each layer is made in a single pass over the
+  // layer below.  The bits of each field are its full tiles; every
+  // other tile with a field beneath it is mixed.
+  nodes.clear();
+
+  std::vector<BlockUpdate> fields(blocks.begin(), blocks.end());
+  std::vector<BlockUpdate> parents;
+  for(unsigned int layer=0; layer+1<num_layers; layer++) {
+    parents.clear();
+    for(const auto& field : fields) {
+      bool full = field.bits.all();
+      if(!full && (layer == 0 || field.bits.any())) {
+        store_node(field.key, field.bits);
+      }
 
+      auto parent_key = get_parent_key(field.key);
+      if(parents.empty() || parents.back().key != parent_key) {
+        parents.push_back({parent_key, Bitfield(0)});
+      }
+      if(full) {
+        parents.back().bits.set(get_bitfield_loc(field.key, layer+1));
+      }
+    }
+    std::swap(fields, parents);
+  }
 
-  // Find each adjacent field
-  auto left_field = find_field(info.x_min-1, info.y_min);
-  auto right_field = find_field(info.x_min+info.field_width, info.y_min);
-  auto up_field = find_field(info.x_min, info.y_min+info.field_width);
-  auto down_field = find_field(info.x_min, info.y_min-1);
+  // The top node is always stored, even if uniform.
+  store_node(top_key(), fields.empty() ? Bitfield(0) : fields.front().bits);
+  finish_rebuild();
+}
 
-  // Determine which values are being spread onto the current layer
-  auto from_right = (left_field & Bitfield(0x8080808080808080)) >> 7;
-  auto from_left = (right_field & Bitfield(0x0101010101010101)) << 7;
-  auto from_down = (down_field & Bitfield(0xff00000000000000)) >> 56;
-  auto from_up = (up_field & Bitfield(0x00000000000000ff)) << 56;
+std::uint64_t GrassyBitfield::num_filled() const {
+  return nodes[nodes.find(top_key())].population;
+}
 
-  // Generate a bitfield of the new spread that occurs.
-  Bitfield no_left_side = 0x7f7f7f7f7f7f7f7f;
-  Bitfield no_right_side = 0xfefefefefefefefe;
-  auto new_spread_left = (((bitfield & no_left_side) << 1) | from_right) & ~bitfield;
-  auto new_spread_right = (((bitfield & no_right_side) >> 1) | from_left) & ~bitfield;
-  auto new_spread_down = ((bitfield >> 8) | from_up) & ~bitfield;
-  auto new_spread_up = ((bitfield << 8) | from_down) & ~bitfield;
+std::uint64_t GrassyBitfield::count_in_rect(std::uint32_t x_min, std::uint32_t y_min,
+                                            std::uint32_t x_max, std::uint32_t y_max) const {
+  x_max = std::min(x_max, get_size());
+  y_max = std::min(y_max, get_size());
+  if(x_min >= x_max || y_min >= y_max) {
+    return 0;
+  }
 
-  if(info.layer == 0) {
-    // If we are in the lowest layer, output gets updated with
-    // from_left | from_right | from_up | from_down.
+  return count_in_rect(nodes.find(top_key()), false, x_min, y_min, x_max, y_max);
+}
 
-    output[key] =
-      new_spread_left | new_spread_right | new_spread_down | new_spread_up;
-  } else {
-    // If we are not in the lowest layer, for each tile, if it has a
-    // subgrid, recursively call to that subgrid.  If not, then check if
-    // any of the adjacent fields cause lowest-level fields to need to
-    // be added to the adjacency.
-    for(unsigned int loc=0; loc<64; loc++) {
-      auto subfield_key = get_subfield_key(key, loc);
-      if(needs_recursion(subfield_key)) {
-        // Further refinement exists, so let that level handle it.
-        determine_new_growth(subfield_key, bitfield.test(loc), output);
-      } else {
-        // No further refinement exists.  Therefore, any new spread
-        // must now be generated as new fields.
-        auto subinfo = unpack_bitfield_key(subfield_key);
-
-        // Line the left edge with left-edge filled
-        if(new_spread_left.test(loc)) {
-          auto x = subinfo.x_min;
-          for(std::uint32_t y = subinfo.y_min; y<subinfo.y_min+subinfo.field_width; y += 8) {
-            auto new_field = get_bitfield_key(x, y, subinfo.layer);
-            output[new_field] |= Bitfield(0x0101010101010101);
-          }
-        }
+std::uint64_t GrassyBitfield::count_in_rect(index_t index, bool parent_value,
+                                            std::uint32_t x_min, std::uint32_t y_min,
+                                            std::uint32_t x_max, std::uint32_t y_max) const {
+  const auto& node = nodes[index];
+  auto info = unpack_bitfield_key(node.key);
 
-        // Line the right edge with right-edge filled
-        if(new_spread_right.test(loc)) {
-          auto x = subinfo.x_min + subinfo.field_width - 1;
-          for(std::uint32_t y = subinfo.y_min; y<subinfo.y_min+subinfo.field_width; y += 8) {
-            auto new_field = get_bitfield_key(x, y, subinfo.layer);
-            output[new_field] |= Bitfield(0x8080808080808080);
-          }
-        }
+  // Node is entirely within the rectangle, no need to descend.
+  if(x_min <= info.x_min && info.x_min + info.field_width <= x_max &&
+     y_min <= info.y_min && info.y_min + info.field_width <= y_max) {
+    return node.population;
+  }
 
-        // Line the bottom edge with bottom-edge filled
-        if(new_spread_down.test(loc)) {
-          auto y = subinfo.y_min;
-          for(std::uint32_t x = subinfo.x_min; x<subinfo.x_min+subinfo.field_width; x += 8) {
-            auto new_field = get_bitfield_key(x, y, subinfo.layer);
-            output[new_field] |= Bitfield(0xff00000000000000);
-          }
-        }
+  Bitfield bitfield = node.stored ? node.bits : Bitfield(parent_value ? -1L : 0);
 
-        // Line the top edge with top-edge filled spaces
-        if(new_spread_up.test(loc)) {
-          auto y = subinfo.y_min + subinfo.field_width - 1;
-          for(std::uint32_t x = subinfo.x_min; x<subinfo.x_min+subinfo.field_width; x += 8) {
-            auto new_field = get_bitfield_key(x, y, subinfo.layer);
-            output[new_field] |= Bitfield(0x00000000000000ff);
-          }
-        }
+  // Range of tiles within this node that overlap the rectangle.
+  auto first_i = (std::max(x_min, info.x_min) - info.x_min) / info.tile_width;
+  auto last_i = (std::min(x_max, info.x_min + info.field_width) - 1 - info.x_min) / info.tile_width;
+  auto first_j = (std::max(y_min, info.y_min) - info.y_min) / info.tile_width;
+  auto last_j = (std::min(y_max, info.y_min + info.field_width) - 1 - info.y_min) / info.tile_width;
+
+  std::uint64_t output = 0;
+  for(auto j = first_j; j <= last_j; j++) {
+    for(auto i = first_i; i <= last_i; i++) {
+      auto loc = 8*j + i;
+      if((node.child_mask >> loc) & 1) {
+        output += count_in_rect(nodes.find(get_subfield_key(node.key, loc)),
+                                bitfield.test(loc),
+                                x_min, y_min, x_max, y_max);
+      } else if(bitfield.test(loc)) {
+        std::uint64_t tile_x = info.x_min + i*info.tile_width;
+        std::uint64_t tile_y = info.y_min + j*info.tile_width;
+        std::uint64_t width = (std::min<std::uint64_t>(x_max, tile_x + info.tile_width) -
+                               std::max<std::uint64_t>(x_min, tile_x));
+        std::uint64_t height = (std::min<std::uint64_t>(y_max, tile_y + info.tile_width) -
+                                std::max<std::uint64_t>(y_min, tile_y));
+        output += width*height;
       }
     }
   }
-}
 
-bool GrassyBitfield::exists_or_has_subfields(std::uint64_t key) const {
-  auto info = unpack_bitfield_key(key);
-  auto top_right_corner = get_address(info.x_min + info.field_width-1,
-                                      info.y_min + info.field_width-1);
-  auto last_possible_subfield = get_bitfield_key(top_right_corner, 0);
-  return bitfields.lower_bound(key) != bitfields.upper_bound(last_possible_subfield);
+  return output;
 }
 
+std::optional<GrassyBitfield::Location> GrassyBitfield::find_nearest_set(
+  double x, double y, double radius) const {
+  NearestSearch search;
+  search.size = get_size();
+  search.edge_wrap = edge_wrap;
+  if(edge_wrap) {
+    x = std::fmod(std::fmod(x, search.size) + search.size, search.size);
+    y = std::fmod(std::fmod(y, search.size) + search.size, search.size);
+  }
+  search.x = x;
+  search.y = y;
+  search.best_dist2 = radius*radius;
+
+  const auto& top = nodes[nodes.find(top_key())];
+  find_nearest_set(top.key, top.bits, top.child_mask, search);
+
+  return search.best;
+}
 
-bool GrassyBitfield::has_subfields(std::uint64_t key) const {
+void GrassyBitfield::find_nearest_set(std::uint64_t key, Bitfield bitfield,
+                                      std::uint64_t child_mask,
+                                      NearestSearch& search) const {
   auto info = unpack_bitfield_key(key);
 
-  auto first_possible_subfield = get_bitfield_key(info.bottom_left_address, info.layer-1);
+  if(info.layer == 0) {
+    // Lowest layer, check each filled tile.
+    auto bits = bitfield.to_ullong();
+    while(bits) {
+      auto loc = __builtin_ctzll(bits);
+      bits &= bits - 1;
+      search.consider(info.x_min + loc%8, info.y_min + loc/8);
+    }
+    return;
+  }
+
+  // Collect each tile that may contain food and may be closer than
+  // the best found so far.  Empty tiles without subfields are
+  // skipped entirely.
+  std::pair<double, unsigned int> candidates[64];
+  unsigned int num_candidates = 0;
+  for(unsigned int loc=0; loc<64; loc++) {
+    if(!((child_mask >> loc) & 1) && !bitfield.test(loc)) {
+      continue;
+    }
+    double dist2 = search.region_dist2(info.x_min + (loc%8)*info.tile_width,
+                                       info.y_min + (loc/8)*info.tile_width,
+                                       info.tile_width);
+    if(search.may_improve(dist2)) {
+      candidates[num_candidates++] = {dist2, loc};
+    }
+  }
+
+  // Visit the closest tiles first, so that later tiles can be pruned.
+  std::sort(candidates, candidates + num_candidates);
+  for(unsigned int i=0; i<num_candidates; i++) {
+    auto dist2 = candidates[i].first;
+    auto loc = candidates[i].second;
+    if(!search.may_improve(dist2)) {
+      break;
+    }
 
-  auto top_right_corner = get_address(info.x_min + info.field_width-1,
-                                      info.y_min + info.field_width-1);
-  auto last_possible_subfield = get_bitfield_key(top_right_corner, 0);
-  return bitfields.lower_bound(first_possible_subfield) != bitfields.upper_bound(last_possible_subfield);
+    if((child_mask >> loc) & 1) {
+      auto subfield_key = get_subfield_key(key, loc);
+      const auto& node = nodes[nodes.find(subfield_key)];
+      Bitfield subfield = node.stored ? node.bits : Bitfield(bitfield.test(loc) ? -1L : 0);
+      find_nearest_set(subfield_key, subfield, node.child_mask, search);
+    } else {
+      // Completely full tile, the nearest location can be found directly.
+      auto x_min = info.x_min + (loc%8)*info.tile_width;
+      auto y_min = info.y_min + (loc/8)*info.tile_width;
+      search.consider(search.axis_nearest(search.x, x_min, info.tile_width),
+                      search.axis_nearest(search.y, y_min, info.tile_width));
+    }
+  }
 }
 
+std::optional<GrassyBitfield::Location> GrassyBitfield::take_nearest(
+  double x, double y, double radius) {
+  auto location = find_nearest_set(x, y, radius);
+  if(location) {
+    set_val(location->x, location->y, false);
+  }
+  return location;
+}
 
-std::vector<GrassyBitfield::DrawField> GrassyBitfield::get_draw_fields() const {
-  std::vector<DrawField> output;
+/// A sector of a disk, as used by count_in_sector
+/*
+  Directions are compared by the cosine of the angle from the center
+  of the sector, so that each tile needs no trigonometry.  Whole
+  fields are classified by the angles of their corners, with a small
+  margin, so that a field is only counted as a whole if every tile
+  center in it would give the same answer.
+ */
+struct GrassyBitfield::Sector {
+  NearestSearch geometry;
+  double radius2;
+  double direction;
+  double half_angle;
+  double dir_x;
+  double dir_y;
+  double cos_half_angle;
+  bool full_circle;
+
+  // Offset from the center to pos along one axis, the shorter way
+  // around if wrapping, in [-size/2, size/2).
+  double offset(double pos, double center) const {
+    if(!geometry.edge_wrap) {
+      return pos - center;
+    }
+    return std::fmod(pos - center + 1.5*geometry.size, geometry.size) - geometry.size/2;
+  }
+
+  bool contains(double tile_x, double tile_y) const {
+    double dx = offset(tile_x, geometry.x);
+    double dy = offset(tile_y, geometry.y);
+    double dist2 = dx*dx + dy*dy;
+    if(dist2 >= radius2) {
+      return false;
+    }
+    if(full_circle || dist2 == 0) {
+      return true;
+    }
+    return dx*dir_x + dy*dir_y >= std::sqrt(dist2)*cos_half_angle;
+  }
+
+  // The tiles of a layer-0 block whose centers are in the sector.
+  Bitfield block_mask(std::uint32_t x_min, std::uint32_t y_min) const {
+    std::uint64_t mask = 0;
+    for(unsigned int loc=0; loc<64; loc++) {
+      if(contains(x_min + loc%8 + 0.5, y_min + loc/8 + 0.5)) {
+        mask |= 1ULL << loc;
+      }
+    }
+    return mask;
+  }
 
-  for(const auto& pair : bitfields) {
-    auto info = unpack_bitfield_key(pair.first);
+  CellState classify(std::uint32_t x_min, std::uint32_t y_min, std::uint32_t width) const {
+    // Bounds of the centers of the tiles in the field.
+    double x_low = x_min + 0.5;
+    double y_low = y_min + 0.5;
+    double x_high = x_low + width - 1;
+    double y_high = y_low + width - 1;
+
+    double min_dx = geometry.axis_dist(geometry.x, x_low, x_high);
+    double min_dy = geometry.axis_dist(geometry.y, y_low, y_high);
+    if(min_dx*min_dx + min_dy*min_dy >= radius2) {
+      return CellState::Empty;
+    }
+    double max_dx = geometry.axis_max_dist(geometry.x, x_low, x_high);
+    double max_dy = geometry.axis_max_dist(geometry.y, y_low, y_high);
+    bool within_radius = max_dx*max_dx + max_dy*max_dy < radius2;
+    if(full_circle) {
+      return within_radius ? CellState::Full : CellState::Mixed;
+    }
 
+    // Offsets of the corners, unless the field spans the far side of
+    // the world or holds the center, where the angles are not bounded
+    // by the corners.
+    double dx_low = offset(x_low, geometry.x);
+    double dy_low = offset(y_low, geometry.y);
+    double dx_high = dx_low + (x_high - x_low);
+    double dy_high = dy_low + (y_high - y_low);
+    if((geometry.edge_wrap && (dx_high >= geometry.size/2 || dy_high >= geometry.size/2)) ||
+       (dx_low <= 0 && dx_high >= 0 && dy_low <= 0 && dy_high >= 0)) {
+      return CellState::Mixed;
+    }
 
-    DrawField field;
-    field.x_min = info.x_min;
-    field.y_min = info.y_min;
-    field.width = info.field_width;
+    // Range of angles of the corners, relative to the direction of the
+    // sector.  The field does not hold the center, so the range is
+    // less than pi, and is measured from the angle of the center of the
+    // field to avoid the discontinuity.
+    const double pi = 3.14159265358979323846;
+    auto relative_angle = [&](double dx, double dy) {
+      return std::remainder(std::atan2(dy, dx) - direction, 2*pi);
+    };
+    double center_angle = relative_angle((dx_low + dx_high)/2, (dy_low + dy_high)/2);
+    double angle_low = center_angle;
+    double angle_high = center_angle;
+    for(double dx : {dx_low, dx_high}) {
+      for(double dy : {dy_low, dy_high}) {
+        double angle = center_angle + std::remainder(relative_angle(dx, dy) - center_angle, 2*pi);
+        angle_low = std::min(angle_low, angle);
+        angle_high = std::max(angle_high, angle);
+      }
+    }
 
-    auto bitfield = pair.second;
-    for(unsigned int y=0; y<8; y++) {
-      for(unsigned int x=0; x<8; x++) {
-        field.values[y][x] = bitfield.test(8*y + x);
+    const double margin = 1e-9;
+    if(within_radius && angle_low > -half_angle + margin && angle_high < half_angle - margin) {
+      return CellState::Full;
+    }
+    for(double shift : {-2*pi, 0.0, 2*pi}) {
+      if(angle_high + shift >= -half_angle - margin && angle_low + shift <= half_angle + margin) {
+        return CellState::Mixed;
       }
     }
+    return CellState::Empty;
+  }
+
+  // Number of tile centers in the sector, for a field that is entirely
+  // filled.
+  std::uint64_t count_full(std::uint32_t x_min, std::uint32_t y_min, std::uint32_t width) const {
+    switch(classify(x_min, y_min, width)) {
+      case CellState::Empty:
+        return 0;
+      case CellState::Full:
+        return std::uint64_t(width)*width;
+      case CellState::Mixed:
+        break;
+    }
+
+    if(width == 8) {
+      return block_mask(x_min, y_min).count();
+    }
+    std::uint64_t output = 0;
+    auto tile_width = width/8;
+    for(unsigned int loc=0; loc<64; loc++) {
+      output += count_full(x_min + (loc%8)*tile_width, y_min + (loc/8)*tile_width, tile_width);
+    }
+    return output;
+  }
+};
+
+std::uint64_t GrassyBitfield::count_in_sector(double x, double y, double radius,
+                                              double direction, double half_angle) const {
+  Sector sector;
+  sector.geometry.size = get_size();
+  sector.geometry.edge_wrap = edge_wrap;
+  if(edge_wrap) {
+    x = std::fmod(std::fmod(x, sector.geometry.size) + sector.geometry.size, sector.geometry.size);
+    y = std::fmod(std::fmod(y, sector.geometry.size) + sector.geometry.size, sector.geometry.size);
+  }
+  sector.geometry.x = x;
+  sector.geometry.y = y;
+  sector.radius2 = radius*radius;
+  sector.direction = direction;
+  sector.half_angle = half_angle;
+  sector.dir_x = std::cos(direction);
+  sector.dir_y = std::sin(direction);
+  sector.cos_half_angle = std::cos(half_angle);
+  sector.full_circle = half_angle >= 3.14159265358979323846;
+
+  if(radius <= 0 || half_angle < 0) {
+    return 0;
+  }
+  return count_in_sector(nodes.find(top_key()), false, sector);
+}
+
+std::uint64_t GrassyBitfield::count_in_sector(index_t index, bool parent_value,
+                                              const Sector& sector) const {
+  const auto& node = nodes[index];
+  auto info = unpack_bitfield_key(node.key);
+
+  switch(sector.classify(info.x_min, info.y_min, info.field_width)) {
+    case CellState::Empty:
+      return 0;
+    case CellState::Full:
+      return node.population;
+    case CellState::Mixed:
+      break;
+  }
 
-    output.push_back(field);
+  Bitfield bitfield = node.stored ? node.bits : Bitfield(parent_value ? -1L : 0);
+  if(info.layer == 0) {
+    return (bitfield & sector.block_mask(info.x_min, info.y_min)).count();
   }
 
+  std::uint64_t output = 0;
+  for(unsigned int loc=0; loc<64; loc++) {
+    if((node.child_mask >> loc) & 1) {
+      output += count_in_sector(nodes.find(get_subfield_key(node.key, loc)),
+                                bitfield.test(loc), sector);
+    } else if(bitfield.test(loc)) {
+      output += sector.count_full(info.x_min + (loc%8)*info.tile_width,
+                                  info.y_min + (loc/8)*info.tile_width,
+                                  info.tile_width);
+    }
+  }
   return output;
 }
 
+GrassyBitfield::UniformBlock GrassyBitfield::uniform_block(std::uint32_t x, std::uint32_t y) const {
+  auto index = nodes.find(top_key());
+  bool parent_value = false;
+  while(true) {
+    const auto& node = nodes[index];
+    auto info = unpack_bitfield_key(node.key);
+    Bitfield bitfield = node.stored ? node.bits : Bitfield(parent_value ? -1L : 0);
+
+    auto i = (x - info.x_min) / info.tile_width;
+    auto j = (y - info.y_min) / info.tile_width;
+    auto loc = 8*j + i;
+    if(!((node.child_mask >> loc) & 1)) {
+      return {bitfield.test(loc), info.x_min + i*info.tile_width,
+              info.y_min + j*info.tile_width, info.tile_width};
+    }
+    parent_value = bitfield.test(loc);
+    index = nodes.find(get_subfield_key(node.key, loc));
+  }
+}
+
+std::optional<double> GrassyBitfield::cast_ray(double x, double y, double direction,
+                                               double max_distance) const {
+  std::int64_t size = get_size();
+  if(num_filled() == 0) {
+    return std::nullopt;
+  }
+  if(edge_wrap) {
+    x = std::fmod(std::fmod(x, size) + size, size);
+    y = std::fmod(std::fmod(y, size) + size, size);
+  } else if(x < 0 || y < 0 || x >= size || y >= size) {
+    return std::nullopt;
+  }
+
+  // cos(pi/2) is about 6e-17, not zero.  Components too small to move
+  // the ray by a tile within a few laps are treated as axis-aligned.
+  double dir_x = std::cos(direction);
+  double dir_y = std::sin(direction);
+  const double min_component = 1e-12;
+  if(std::abs(dir_x) < min_component) {
+    dir_x = 0;
+  }
+  if(std::abs(dir_y) < min_component) {
+    dir_y = 0;
+  }
+
+  // A wrapping ray may circle the field forever without reaching a
+  // filled tile.  It is followed for one period in each axis that it
+  // moves along, but no more than two laps, so that the position
+  // keeps its precision.  Each step crosses at least one tile edge,
+  // which bounds the number of steps as well.
+  std::int64_t max_steps = std::numeric_limits<std::int64_t>::max();
+  if(edge_wrap) {
+    double slowest = std::min(dir_x == 0 ? 1 : std::abs(dir_x),
+                              dir_y == 0 ? 1 : std::abs(dir_y));
+    max_distance = std::min({max_distance, size/slowest, 2.0*size});
+    max_steps = 6*size + 2;
+  }
+
+  // The tile that the ray is in, without wrapping, so that the ray
+  // can be followed around the edges.
+  std::int64_t tile_x = std::floor(x);
+  std::int64_t tile_y = std::floor(y);
+  double distance = 0;
+  for(std::int64_t step=0; step<max_steps; step++) {
+    std::int64_t wrapped_x = (tile_x % size + size) % size;
+    std::int64_t wrapped_y = (tile_y % size + size) % size;
+    if(!edge_wrap && (wrapped_x != tile_x || wrapped_y != tile_y)) {
+      return std::nullopt;
+    }
+
+    auto block = uniform_block(wrapped_x, wrapped_y);
+    if(block.value) {
+      return distance;
+    }
+
+    // Step past the empty block, through whichever side the ray
+    // reaches first.
+    std::int64_t block_x = tile_x - (wrapped_x - block.x_min);
+    std::int64_t block_y = tile_y - (wrapped_y - block.y_min);
+    std::int64_t width = block.width;
+    const double never = std::numeric_limits<double>::infinity();
+    double exit_x = (dir_x > 0) ? (block_x + width - x)/dir_x :
+                    (dir_x < 0) ? (block_x - x)/dir_x : never;
+    double exit_y = (dir_y > 0) ? (block_y + width - y)/dir_y :
+                    (dir_y < 0) ? (block_y - y)/dir_y : never;
+    distance = std::max(distance, std::min(exit_x, exit_y));
+    if(distance > max_distance) {
+      return std::nullopt;
+    }
+
+    // The tile on the other axis is found from the position, but
+    // kept within the block, in case of rounding.
+    if(exit_x <= exit_y) {
+      tile_x = (dir_x > 0) ? block_x + width : block_x - 1;
+    } else {
+      tile_x = std::clamp<std::int64_t>(std::floor(x + distance*dir_x), block_x, block_x + width - 1);
+    }
+    if(exit_y <= exit_x) {
+      tile_y = (dir_y > 0) ? block_y + width : block_y - 1;
+    } else {
+      tile_y = std::clamp<std::int64_t>(std::floor(y + distance*dir_y), block_y, block_y + width - 1);
+    }
+  }
+  return std::nullopt;
+}
+
+/// A region of tiles, to be combined with a GrassyBitfield
+/*
+  classify gives the state of an entire field, given its key.  block
+  gives the values of a layer-0 block, and is only called for blocks
+  that are mixed.
+ */
+struct GrassyBitfield::Region {
+  std::function<CellState(std::uint64_t key)> classify;
+  std::function<Bitfield(std::uint64_t key)> block;
+};
+
+void GrassyBitfield::fill_rect(std::uint32_t x_min, std::uint32_t y_min,
+                               std::uint32_t x_max, std::uint32_t y_max) {
+  apply_region(rect_region(x_min, y_min, x_max, y_max), SetOperation::Union);
+}
+
+void GrassyBitfield::clear_rect(std::uint32_t x_min, std::uint32_t y_min,
+                                std::uint32_t x_max, std::uint32_t y_max) {
+  apply_region(rect_region(x_min, y_min, x_max, y_max), SetOperation::Difference);
+}
+
+GrassyBitfield::Region GrassyBitfield::rect_region(std::uint32_t x_min, std::uint32_t y_min,
+                                                   std::uint32_t x_max, std::uint32_t y_max) const {
+  x_max = std::min(x_max, get_size());
+  y_max = std::min(y_max, get_size());
+
+  Region region;
+  region.classify = [=](std::uint64_t key) {
+    auto info = unpack_bitfield_key(key);
+    auto field_x_max = info.x_min + info.field_width;
+    auto field_y_max = info.y_min + info.field_width;
+    if(x_min >= field_x_max || x_max <= info.x_min ||
+       y_min >= field_y_max || y_max <= info.y_min ||
+       x_min >= x_max || y_min >= y_max) {
+      return CellState::Empty;
+    } else if(x_min <= info.x_min && field_x_max <= x_max &&
+              y_min <= info.y_min && field_y_max <= y_max) {
+      return CellState::Full;
+    } else {
+      return CellState::Mixed;
+    }
+  };
+  region.block = [=](std::uint64_t key) {
+    auto info = unpack_bitfield_key(key);
+    Bitfield bits;
+    for(unsigned int loc=0; loc<64; loc++) {
+      auto x = info.x_min + loc%8;
+      auto y = info.y_min + loc/8;
+      bits.set(loc, x >= x_min && x < x_max && y >= y_min && y < y_max);
+    }
+    return bits;
+  };
+  return region;
+}
+
+void GrassyBitfield::fill_disk(double x, double y, double radius) {
+  NearestSearch geometry;
+  geometry.size = get_size();
+  geometry.edge_wrap = edge_wrap;
+  if(edge_wrap) {
+    x = std::fmod(std::fmod(x, geometry.size) + geometry.size, geometry.size);
+    y = std::fmod(std::fmod(y, geometry.size) + geometry.size, geometry.size);
+  }
+  geometry.x = x;
+  geometry.y = y;
+  double radius2 = radius*radius;
+
+  Region region;
+  region.classify = [&](std::uint64_t key) {
+    auto info = unpack_bitfield_key(key);
+    // Bounds of the centers of the tiles in the field.
+    double x_low = info.x_min + 0.5;
+    double y_low = info.y_min + 0.5;
+    double x_high = x_low + info.field_width - 1;
+    double y_high = y_low + info.field_width - 1;
+
+    double min_dx = geometry.axis_dist(x, x_low, x_high);
+    double min_dy = geometry.axis_dist(y, y_low, y_high);
+    if(min_dx*min_dx + min_dy*min_dy >= radius2) {
+      return CellState::Empty;
+    }
+
+    double max_dx = geometry.axis_max_dist(x, x_low, x_high);
+    double max_dy = geometry.axis_max_dist(y, y_low, y_high);
+    if(max_dx*max_dx + max_dy*max_dy < radius2) {
+      return CellState::Full;
+    }
+
+    return CellState::Mixed;
+  };
+  region.block = [&](std::uint64_t key) {
+    auto info = unpack_bitfield_key(key);
+    Bitfield bits;
+    for(unsigned int loc=0; loc<64; loc++) {
+      double tile_x = info.x_min + loc%8 + 0.5;
+      double tile_y = info.y_min + loc/8 + 0.5;
+      double dx = geometry.axis_dist(x, tile_x, tile_x);
+      double dy = geometry.axis_dist(y, tile_y, tile_y);
+      bits.set(loc, dx*dx + dy*dy < radius2);
+    }
+    return bits;
+  };
+
+  apply_region(region, SetOperation::Union);
+}
+
+void GrassyBitfield::union_with(const GrassyBitfield& other) {
+  combine_with(other, SetOperation::Union);
+}
+
+void GrassyBitfield::intersect_with(const GrassyBitfield& other) {
+  combine_with(other, SetOperation::Intersection);
+}
+
+void GrassyBitfield::subtract(const GrassyBitfield& other) {
+  combine_with(other, SetOperation::Difference);
+}
+
+void GrassyBitfield::combine_with(const GrassyBitfield& other, SetOperation op) {
+  if(other.num_layers != num_layers) {
+    throw std::invalid_argument("Bitfields must have the same number of layers");
+  }
+  require_single_plane("Set operations");
+  other.require_single_plane("Set operations");
+
+  // The nodes of this field are replaced while the region is read,
+  // so a field combined with itself is handled separately.
+  if(&other == this) {
+    if(op == SetOperation::Difference) {
+      load_blocks({});
+    }
+    return;
+  }
+
+  Region region;
+  region.classify = [&](std::uint64_t key) {
+    auto index = other.nodes.find(key);
+    if(index != BitfieldNodePool::npos) {
+      const auto& node = other.nodes[index];
+      if(node.child_mask == 0 && node.stored && node.bits.all()) {
+        return CellState::Full;
+      } else if(node.child_mask == 0 && node.stored && node.bits.none()) {
+        return CellState::Empty;
+      } else {
+        return CellState::Mixed;
+      }
+    }
+
+    // No node for the field, so it is uniform, with the value
+    // given by the lowest stored node above it.
+    auto address = key & 0xffffffffffffffc0;
+    const auto& node = other.nodes[other.lowest_stored_node(address, get_key_layer(key))];
+    bool value = node.bits.test(get_bitfield_loc(address, get_key_layer(node.key)));
+    return value ? CellState::Full : CellState::Empty;
+  };
+  region.block = [&](std::uint64_t key) {
+    return other.get_field(key & 0xffffffffffffffc0, 0);
+  };
+
+  apply_region(region, op);
+}
+
+void GrassyBitfield::apply_region(const Region& region, SetOperation op) {
+  require_single_plane("Region operations");
+
+  // Build the result into an empty pool, reading from the previous
+  // nodes, then regenerate the populations and changed blocks.
+  BitfieldNodePool old_nodes;
+  std::swap(nodes, old_nodes);
+  combine_field(old_nodes, top_key(), old_nodes.find(top_key()), false, region, op);
+
+  // Assignment keeps the storage of the previous nodes, which may be
+  // mapped to a file.
+  if(old_nodes.is_file_backed()) {
+    old_nodes = nodes;
+    std::swap(nodes, old_nodes);
+  }
+  finish_rebuild();
+}
+
+GrassyBitfield::CellState GrassyBitfield::combine_field(
+  const BitfieldNodePool& old_nodes, std::uint64_t key, index_t index, bool value,
+  const Region& region, SetOperation op) {
+
+  auto apply = [op](Bitfield a, Bitfield b) {
+    switch(op) {
+      case SetOperation::Union:
+        return a | b;
+      case SetOperation::Intersection:
+        return a & b;
+      case SetOperation::Difference:
+        return a & ~b;
+    }
+    return a;
+  };
+
+  // Previous values of the field.  If there is no node, the field is
+  // uniform with the value of its parent's tile.
+  Bitfield bits(value ? -1L : 0);
+  std::uint64_t child_mask = 0;
+  if(index != BitfieldNodePool::npos) {
+    if(old_nodes[index].stored) {
+      bits = old_nodes[index].bits;
+    }
+    child_mask = old_nodes[index].child_mask;
+  }
+
+  auto region_state = region.classify(key);
+  Bitfield region_bits(region_state == CellState::Full ? -1L : 0);
+
+  Bitfield full_tiles;
+  bool any_mixed = false;
+  if(region_state != CellState::Mixed &&
+     apply(0, region_bits) == apply(-1L, region_bits)) {
+    // The result does not depend on the previous values, so none of
+    // the previous subfields need to be visited.
+    full_tiles = apply(0, region_bits);
+
+  } else if(get_key_layer(key) == 0) {
+    if(region_state == CellState::Mixed) {
+      region_bits = region.block(key);
+    }
+    full_tiles = apply(bits, region_bits);
+
+  } else if(region_state != CellState::Mixed && child_mask == 0) {
+    // Both are uniform on each tile.
+    full_tiles = apply(bits, region_bits);
+
+  } else {
+    for(unsigned int loc=0; loc<64; loc++) {
+      auto subfield_key = get_subfield_key(key, loc);
+      bool has_subfield = (child_mask >> loc) & 1;
+      auto subfield_index = has_subfield ? old_nodes.find(subfield_key) : BitfieldNodePool::npos;
+
+      auto state = combine_field(old_nodes, subfield_key, subfield_index, bits.test(loc),
+                                 region, op);
+      if(state == CellState::Full) {
+        full_tiles.set(loc);
+      } else if(state == CellState::Mixed) {
+        any_mixed = true;
+      }
+    }
+  }
+
+  return store_field(key, full_tiles, any_mixed);
+}
+
+void GrassyBitfield::growth_iteration() {
+  // A block can only grow if it, or one of its neighbors, has changed
+  // since the previous iteration.  Every other block has already
+  // grown as much as its neighbors allow, or is completely full.
+  frontier.clear();
+  for(auto key : changed_blocks) {
+    frontier.push_back(key);
+    for(auto neighbor : {neighbor_key(key, -1, 0), neighbor_key(key, +1, 0),
+                         neighbor_key(key, 0, -1), neighbor_key(key, 0, +1)}) {
+      if(neighbor != -1UL) {
+        frontier.push_back(neighbor);
+      }
+    }
+  }
+  changed_blocks.clear();
+
+  std::sort(frontier.begin(), frontier.end());
+  frontier.erase(std::unique(frontier.begin(), frontier.end()), frontier.end());
+
+  // All growth is determined before any is applied, so that food
+  // spreads by exactly one tile per iteration.
+  pending_growth.clear();
+  if(thread_pool && num_layers > 1 && frontier.size() >= min_parallel_frontier) {
+    // The frontier is in Morton order, so the blocks of each
+    // top-level subfield are contiguous.  Each subfield is handled by
+    // one task, and the results concatenated in the original order.
+    subtree_starts.clear();
+    for(std::size_t i=0; i<frontier.size(); i++) {
+      if(i==0 ||
+         get_bitfield_loc(frontier[i], num_layers-1) !=
+         get_bitfield_loc(frontier[i-1], num_layers-1)) {
+        subtree_starts.push_back(i);
+      }
+    }
+    subtree_starts.push_back(frontier.size());
+
+    auto num_subtrees = subtree_starts.size() - 1;
+    if(subtree_growth.size() < num_subtrees) {
+      subtree_growth.resize(num_subtrees);
+    }
+    thread_pool->parallel_for(num_subtrees, [&](std::size_t i) {
+        subtree_growth[i].clear();
+        collect_growth(frontier.data() + subtree_starts[i],
+                       frontier.data() + subtree_starts[i+1],
+                       subtree_growth[i]);
+      });
+
+    for(std::size_t i=0; i<num_subtrees; i++) {
+      pending_growth.insert(pending_growth.end(),
+                            subtree_growth[i].begin(), subtree_growth[i].end());
+    }
+  } else {
+    collect_growth(frontier.data(), frontier.data() + frontier.size(),
+                   pending_growth);
+  }
+
+  for(const auto& update : pending_growth) {
+    if(update.grew) {
+      set_block(update.key, update.planes);
+    }
+    changed_blocks.push_back(update.key);
+  }
+  growth_generation++;
+}
+
+void GrassyBitfield::collect_growth(const std::uint64_t* begin,
+                                    const std::uint64_t* end,
+                                    std::vector<BlockPlanes>& output) const {
+  for(auto it = begin; it != end; it++) {
+    auto index = find_stored(*it);
+    bool any_growth = false;
+    bool deferred = false;
+    Planes planes = {};
+    for(unsigned int plane=0; plane<num_planes; plane++) {
+      auto bitfield = (index != BitfieldNodePool::npos) ?
+        plane_bits(index, plane) : get_field(*it, 0, plane);
+      auto new_growth = determine_new_growth(*it, index, plane, bitfield, deferred);
+      planes[plane] = bitfield | new_growth;
+      any_growth = any_growth || new_growth.any();
+    }
+
+    // A block whose growth was skipped by chance is kept on the
+    // frontier, as neither it nor its neighbors may change again.
+    if(any_growth || deferred) {
+      output.push_back({*it, planes, any_growth});
+    }
+  }
+}
+
+void GrassyBitfield::set_growth_probability(double probability) {
+  if(!(probability >= 0 && probability <= 1)) {
+    throw std::invalid_argument("Growth probability must be between 0 and 1");
+  }
+  growth_threshold = std::lround(probability * full_growth_threshold);
+}
+
+double GrassyBitfield::get_growth_probability() const {
+  return double(growth_threshold) / full_growth_threshold;
+}
+
+void GrassyBitfield::set_growth_seed(std::uint64_t seed) {
+  growth_seed = seed;
+  growth_generation = 0;
+}
+
+void GrassyBitfield::map_to_file(const std::string& path) {
+  nodes.map_to_files(path);
+  reorder_nodes();
+}
+
+void GrassyBitfield::reorder_nodes() {
+  // The neighbor links are remapped by the pool, and every other
+  // reference to a node is by key.
+  nodes.sort_by_key();
+}
+
+void GrassyBitfield::save(SnapshotWriter& out) const {
+  out.write(snapshot_magic);
+  out.write(snapshot_version);
+  out.write<std::uint32_t>(num_layers);
+  out.write<std::uint32_t>(num_planes);
+  out.write<std::uint8_t>(edge_wrap);
+  out.write(growth_threshold);
+  out.write(growth_seed);
+  out.write(growth_generation);
+  out.write(version);
+
+  out.write<std::uint64_t>(changed_blocks.size());
+  out.write_bytes(changed_blocks.data(), changed_blocks.size()*sizeof(std::uint64_t));
+
+  nodes.save(out);
+}
+
+GrassyBitfield GrassyBitfield::load(SnapshotReader& in) {
+  in.expect(snapshot_magic, "GrassyBitfield");
+  auto format_version = in.read<std::uint32_t>();
+  if(format_version != snapshot_version) {
+    std::stringstream ss;
+    ss << "Unsupported GrassyBitfield snapshot version " << format_version;
+    throw std::runtime_error(ss.str());
+  }
+
+  auto num_layers = in.read<std::uint32_t>();
+  auto num_planes = in.read<std::uint32_t>();
+  bool edge_wrap = in.read<std::uint8_t>();
+  GrassyBitfield field(num_layers, false, edge_wrap, num_planes);
+  field.growth_threshold = in.read<std::uint32_t>();
+  field.growth_seed = in.read<std::uint64_t>();
+  field.growth_generation = in.read<std::uint64_t>();
+  field.version = in.read<std::uint64_t>();
+  field.forgotten_version = field.version;
+  field.change_log.clear();
+
+  auto num_changed = in.read<std::uint64_t>();
+  if(num_changed > in.remaining()/sizeof(std::uint64_t)) {
+    throw std::runtime_error("Snapshot is truncated");
+  }
+  auto changed_data = in.read_bytes(num_changed*sizeof(std::uint64_t));
+  field.changed_blocks.resize(num_changed);
+  if(num_changed) {
+    std::memcpy(field.changed_blocks.data(), changed_data,
+                num_changed*sizeof(std::uint64_t));
+  }
+
+  field.nodes.load(in);
+  field.validate_nodes();
+  return field;
+}
+
+bool GrassyBitfield::is_valid_key(std::uint64_t key) const {
+  // The layer is stored as 15-layer in the low 4 bits, and the
+  // address below the field is zero.
+  if((key & 0x30) || (key & 15) < 16 - num_layers) {
+    return false;
+  }
+  auto layer = get_key_layer(key);
+  auto address = key & ~std::uint64_t(0x3f);
+  return ((address & ((1UL << (6*(layer+1))) - 1)) == 0 &&
+          (address >> (6*num_layers)) == 0);
+}
+
+void GrassyBitfield::validate_nodes() const {
+  auto fail = [](const std::string& message) {
+    throw std::runtime_error("Snapshot is corrupt: " + message);
+  };
+
+  if(nodes.find(top_key()) == BitfieldNodePool::npos) {
+    fail("no top-level node");
+  }
+
+  for(index_t index=0; index<nodes.size(); index++) {
+    const auto& node = nodes[index];
+    if(!is_valid_key(node.key)) {
+      fail("invalid node key");
+    }
+    auto layer = get_key_layer(node.key);
+
+    if(layer + 1 < num_layers) {
+      auto parent = nodes.find(get_parent_key(node.key));
+      auto loc = get_bitfield_loc(node.key, layer + 1);
+      if(parent == BitfieldNodePool::npos || !((nodes[parent].child_mask >> loc) & 1)) {
+        fail("node is not a child of its parent");
+      }
+    }
+
+    if(layer == 0 && node.child_mask) {
+      fail("block has children");
+    }
+    auto child_mask = node.child_mask;
+    while(child_mask) {
+      auto loc = __builtin_ctzll(child_mask);
+      child_mask &= child_mask - 1;
+      auto child_key = get_subfield_key(node.key, loc);
+      if(nodes.find(child_key) == BitfieldNodePool::npos) {
+        fail("missing child node");
+      }
+    }
+
+    for(unsigned int i=0; i<4; i++) {
+      auto neighbor = node.neighbors[i];
+      if(neighbor != BitfieldNodePool::npos &&
+         nodes[neighbor].key != neighbor_key(node.key, neighbor_offsets[i][0],
+                                             neighbor_offsets[i][1])) {
+        fail("node is linked to a node that is not its neighbor");
+      }
+    }
+  }
+
+  for(auto key : changed_blocks) {
+    if(!is_valid_key(key) || get_key_layer(key) != 0) {
+      fail("invalid changed block");
+    }
+  }
+}
+
+void GrassyBitfield::set_num_threads(unsigned int num_threads) {
+  if(num_threads > 1) {
+    thread_pool = std::make_shared<ThreadPool>(num_threads);
+  } else {
+    thread_pool = nullptr;
+  }
+}
+
+void GrassyBitfield::set_thread_pool(std::shared_ptr<ThreadPool> pool) {
+  thread_pool = std::move(pool);
+}
+
+unsigned int GrassyBitfield::get_num_threads() const {
+  return thread_pool ? thread_pool->get_num_threads() : 1;
+}
+
+GrassyBitfield::Bitfield GrassyBitfield::get_field(std::uint64_t address,
+                                                   unsigned int layer,
+                                                   unsigned int plane) const {
+  // Find the grid on the same level or higher that contains the
+  // specified point.
+  if(address==-1UL) {
+    return Bitfield(0);
+  }
+
+  // Most lookups during growth are of blocks that are stored, which
+  // are found with a single probe rather than a walk from the top.
+  auto index = find_stored(get_bitfield_key(address, layer));
+  if(index != BitfieldNodePool::npos) {
+    return plane_bits(index, plane);
+  }
+
+  index = lowest_stored_node(address, layer);
+  auto node_layer = get_key_layer(nodes[index].key);
+  if(node_layer == layer) {
+    // Field is stored on this layer, return bitfield as is.
+    return plane_bits(index, plane);
+  } else {
+    // Field is uniform, and stored on a higher layer.  Return a
+    // full/empty bitfield.
+    auto loc = get_bitfield_loc(address, node_layer);
+    bool value = plane_bits(index, plane).test(loc);
+    return Bitfield(value ? -1L : 0);
+  }
+}
+
+GrassyBitfield::Planes GrassyBitfield::get_planes(std::uint64_t address,
+                                                  unsigned int layer) const {
+  Planes planes = {};
+  for(unsigned int plane=0; plane<num_planes; plane++) {
+    planes[plane] = get_field(address, layer, plane);
+  }
+  return planes;
+}
+
+std::uint64_t GrassyBitfield::neighbor_key(std::uint64_t key, int dx, int dy) const {
+  // Returns the key of the field on the same layer offset by (dx,dy)
+  // fields, or -1 if that field is off the edge and edge wrapping is
+  // disabled.  dx and dy must each be -1, 0, or +1.
+  auto layer = get_key_layer(key);
+  std::uint64_t field_bits = (1UL << (6*(layer+1))) - 1;
+  std::uint64_t world_bits = (1UL << (6*num_layers)) - 1;
+
+  // Step the coordinate within the interleaved address directly.
+  // Filling the bits of the other coordinate with ones lets the carry
+  // of an increment pass through them, and masking to the size of
+  // the world wraps around the edges.
+  auto step = [&](std::uint64_t address, int delta,
+                  std::uint64_t coordinate_bits, std::uint64_t unit) {
+    auto field_coordinate_bits = coordinate_bits & world_bits & ~field_bits;
+    auto coordinate = address & field_coordinate_bits;
+
+    bool off_edge = ((delta > 0 && coordinate == field_coordinate_bits) ||
+                     (delta < 0 && coordinate == 0));
+    if(off_edge && !edge_wrap) {
+      return std::uint64_t(-1);
+    }
+
+    if(delta > 0) {
+      coordinate = ((address | ~field_coordinate_bits) + unit) & field_coordinate_bits;
+    } else {
+      coordinate = (coordinate - unit) & field_coordinate_bits;
+    }
+    return (address & ~field_coordinate_bits) | coordinate;
+  };
+
+  std::uint64_t address = key & ~field_bits;
+  if(dx) {
+    address = step(address, dx, x_address_bits, 1UL << (6*(layer+1)));
+  }
+  if(dy && address != -1UL) {
+    address = step(address, dy, y_address_bits, 1UL << (6*(layer+1) + 3));
+  }
+
+  if(address == -1UL) {
+    return address;
+  }
+  return get_bitfield_key(address, layer);
+}
+
+GrassyBitfield::Bitfield GrassyBitfield::determine_new_growth(
+  std::uint64_t key, index_t index, unsigned int plane, Bitfield bitfield,
+  bool& deferred) const {
+  // Returns the tiles of a layer-0 block that become filled in one
+  // plane this iteration.  The index is the stored node of the
+  // block, or npos if the block is not stored.  Sets deferred if
+  // some growth was possible, but did not happen by chance.
+
+  // Find each adjacent field.  Stored blocks have links to their
+  // stored neighbors.  Otherwise, the neighbor's value is held by
+  // some layer above.
+  Bitfield neighbor_fields[4];
+  for(unsigned int i=0; i<4; i++) {
+    auto neighbor_index = (index != BitfieldNodePool::npos) ?
+      nodes[index].neighbors[i] : BitfieldNodePool::npos;
+    if(neighbor_index != BitfieldNodePool::npos) {
+      neighbor_fields[i] = plane_bits(neighbor_index, plane);
+    } else {
+      neighbor_fields[i] = get_field(neighbor_key(key, neighbor_offsets[i][0],
+                                                  neighbor_offsets[i][1]), 0, plane);
+    }
+  }
+  auto& left_field = neighbor_fields[0];
+  auto& right_field = neighbor_fields[1];
+  auto& down_field = neighbor_fields[2];
+  auto& up_field = neighbor_fields[3];
+
+  // Determine which values are being spread onto the current layer
+  auto from_right = (left_field & Bitfield(0x8080808080808080)) >> 7;
+  auto from_left = (right_field & Bitfield(0x0101010101010101)) << 7;
+  auto from_down = (down_field & Bitfield(0xff00000000000000)) >> 56;
+  auto from_up = (up_field & Bitfield(0x00000000000000ff)) << 56;
+
+  // Generate a bitfield of the new spread that occurs.
+  Bitfield no_left_side = 0x7f7f7f7f7f7f7f7f;
+  Bitfield no_right_side = 0xfefefefefefefefe;
+  auto new_spread_left = (((bitfield & no_left_side) << 1) | from_right) & ~bitfield;
+  auto new_spread_right = (((bitfield & no_right_side) >> 1) | from_left) & ~bitfield;
+  auto new_spread_down = ((bitfield >> 8) | from_up) & ~bitfield;
+  auto new_spread_up = ((bitfield << 8) | from_down) & ~bitfield;
+  auto new_growth = new_spread_left | new_spread_right | new_spread_down | new_spread_up;
+  if(growth_threshold >= full_growth_threshold || new_growth.none()) {
+    return new_growth;
+  }
+
+  // Each direction of spread is kept with the growth probability,
+  // independently for each tile.
+  auto state = mix64(growth_seed ^ mix64(key ^ mix64(growth_generation)));
+  std::uint64_t stream = 4*plane;
+  new_spread_left &= random_mask(state, stream, growth_threshold);
+  new_spread_right &= random_mask(state, stream+1, growth_threshold);
+  new_spread_down &= random_mask(state, stream+2, growth_threshold);
+  new_spread_up &= random_mask(state, stream+3, growth_threshold);
+
+  auto kept = new_spread_left | new_spread_right | new_spread_down | new_spread_up;
+  if(kept != new_growth) {
+    deferred = true;
+  }
+  return kept;
+}
+
+void GrassyBitfield::growth_iterations(std::uint64_t num_iterations) {
+  // For a small number of iterations, the conversion to and from the
+  // quadtree costs more than it saves.  The quadtree only holds a
+  // single plane, and only evolves deterministic growth.
+  if(num_layers == 1 || num_planes > 1 || num_iterations < min_memoized_iterations ||
+     growth_threshold < full_growth_threshold) {
+    for(std::uint64_t i=0; i<num_iterations; i++) {
+      growth_iteration();
+    }
+    return;
+  }
+
+  auto total_iterations = num_iterations;
+  if(growth_memo.size() > max_memoized_nodes) {
+    growth_memo.clear();
+  }
+
+  auto world_level = 3*num_layers;
+  auto world = to_quadtree(nodes.find(top_key()), false);
+  auto empty = growth_memo.uniform(world_level-1, false);
+
+  while(num_iterations &&
+        !growth_memo.is_uniform(world, false) &&
+        !growth_memo.is_uniform(world, true)) {
+    // The world is placed at the center of a node twice its width,
+    // which can then be advanced by up to half the world width.
+    unsigned int log2_steps = world_level-1;
+    while((1ULL << log2_steps) > num_iterations) {
+      log2_steps--;
+    }
+
+    if(edge_wrap) {
+      // Tile the world, then swap the quadrants of the result to
+      // undo the offset of the center.
+      auto padded = growth_memo.join(world, world, world, world);
+      auto result = growth_memo.advance(padded, log2_steps);
+      world = growth_memo.join(growth_memo.child(result, 3), growth_memo.child(result, 2),
+                               growth_memo.child(result, 1), growth_memo.child(result, 0));
+    } else {
+      // Surround the world with empty space.  Growth into the empty
+      // space never reaches back into the world any sooner than it
+      // would have within the world.
+      GrowthQuadtree::node_t quadrants[4];
+      for(unsigned int i=0; i<4; i++) {
+        quadrants[i] = growth_memo.child(world, i);
+      }
+      auto padded = growth_memo.join(growth_memo.join(empty, empty, empty, quadrants[0]),
+                                     growth_memo.join(empty, empty, quadrants[1], empty),
+                                     growth_memo.join(empty, quadrants[2], empty, empty),
+                                     growth_memo.join(quadrants[3], empty, empty, empty));
+      world = growth_memo.advance(padded, log2_steps);
+    }
+
+    num_iterations -= 1ULL << log2_steps;
+  }
+
+  growth_generation += total_iterations;
+  load_quadtree(world);
+}
+
+GrowthQuadtree::node_t GrassyBitfield::to_quadtree(index_t index, bool parent_value) {
+  const auto& node = nodes[index];
+  Bitfield bitfield = node.stored ? node.bits : Bitfield(parent_value ? -1L : 0);
+  auto layer = get_key_layer(node.key);
+
+  if(layer == 0) {
+    return growth_memo.leaf(bitfield.to_ullong());
+  }
+
+  GrowthQuadtree::node_t grid[8][8];
+  for(unsigned int loc=0; loc<64; loc++) {
+    if((node.child_mask >> loc) & 1) {
+      grid[loc/8][loc%8] = to_quadtree(nodes.find(get_subfield_key(node.key, loc)),
+                                       bitfield.test(loc));
+    } else {
+      grid[loc/8][loc%8] = growth_memo.uniform(3*layer, bitfield.test(loc));
+    }
+  }
+
+  // Combine 2x2 groups until only a single node is left.
+  for(unsigned int width=4; width>0; width/=2) {
+    for(unsigned int y=0; y<width; y++) {
+      for(unsigned int x=0; x<width; x++) {
+        grid[y][x] = growth_memo.join(grid[2*y][2*x], grid[2*y][2*x+1],
+                                      grid[2*y+1][2*x], grid[2*y+1][2*x+1]);
+      }
+    }
+  }
+
+  return grid[0][0];
+}
+
+void GrassyBitfield::load_quadtree(GrowthQuadtree::node_t world) {
+  nodes.clear();
+  build_from_quadtree(top_key(), world);
+  finish_rebuild();
+}
+
+void GrassyBitfield::finish_rebuild() {
+  // After the nodes have been rebuilt from scratch, the populations
+  // and the blocks to be examined by the next growth are regenerated.
+  mark_all_dirty();
+
+  auto top = nodes.find(top_key());
+  recount_population(top, false);
+  changed_blocks.clear();
+  mark_all_changed(top, false);
+
+  if(nodes.is_file_backed()) {
+    reorder_nodes();
+  }
+}
+
+GrassyBitfield::CellState GrassyBitfield::build_from_quadtree(
+  std::uint64_t key, GrowthQuadtree::node_t quad) {
+  // Builds the same structure as setting each filled tile in an
+  // empty field.  A node is stored if it is mixed and has at least one
+  // full tile, with subfields for each mixed tile.
+
+  auto layer = get_key_layer(key);
+
+  Bitfield full_tiles;
+  bool any_mixed = false;
+  if(layer == 0) {
+    full_tiles = growth_memo.leaf_bits(quad);
+  } else {
+    for(unsigned int loc=0; loc<64; loc++) {
+      unsigned int x = loc%8;
+      unsigned int y = loc/8;
+      auto cell = quad;
+      for(int bit=2; bit>=0; bit--) {
+        cell = growth_memo.child(cell, 2*((y>>bit)&1) + ((x>>bit)&1));
+      }
+
+      if(growth_memo.is_uniform(cell, true)) {
+        full_tiles.set(loc);
+      } else if(!growth_memo.is_uniform(cell, false)) {
+        build_from_quadtree(get_subfield_key(key, loc), cell);
+        any_mixed = true;
+      }
+    }
+  }
+
+  return store_field(key, full_tiles, any_mixed);
+}
+
+GrassyBitfield::CellState GrassyBitfield::store_field(std::uint64_t key, Bitfield full_tiles,
+                                                      bool any_mixed) {
+  // Stores a field of a structure being built from scratch, given
+  // the tiles that are full and whether any tiles are mixed.  Returns
+  // the state of the field as a whole.
+  CellState state;
+  if(any_mixed) {
+    state = CellState::Mixed;
+  } else if(full_tiles.all()) {
+    state = CellState::Full;
+  } else if(full_tiles.none()) {
+    state = CellState::Empty;
+  } else {
+    state = CellState::Mixed;
+  }
+
+  if(key == top_key() ||
+     (state == CellState::Mixed && full_tiles.any())) {
+    store_node(key, full_tiles);
+  }
+
+  return state;
+}
+
+std::uint64_t GrassyBitfield::recount_population(index_t index, bool parent_value) {
+  auto& node = nodes[index];
+  Bitfield bitfield = node.stored ? node.bits : Bitfield(parent_value ? -1L : 0);
+  auto layer = get_key_layer(node.key);
+
+  std::uint64_t child_population = 0;
+  auto child_mask = node.child_mask;
+  while(child_mask) {
+    auto loc = __builtin_ctzll(child_mask);
+    child_mask &= child_mask - 1;
+    child_population += recount_population(nodes.find(get_subfield_key(node.key, loc)),
+                                           bitfield.test(loc));
+  }
+
+  node.child_population = child_population;
+  node.population = (((bitfield & ~Bitfield(node.child_mask)).count() << (6*layer)) +
+                     child_population);
+  return node.population;
+}
+
+void GrassyBitfield::mark_all_changed(index_t index, bool parent_value) {
+  // Marks every block that may grow in the next iteration: each
+  // mixed block, and the edges of each full tile that borders a tile
+  // that is not full.
+  const auto& node = nodes[index];
+  auto info = unpack_bitfield_key(node.key);
+  if(info.layer == 0) {
+    changed_blocks.push_back(node.key);
+    return;
+  }
+
+  Bitfield bitfield = node.stored ? node.bits : Bitfield(parent_value ? -1L : 0);
+  for(unsigned int loc=0; loc<64; loc++) {
+    if((node.child_mask >> loc) & 1) {
+      mark_all_changed(nodes.find(get_subfield_key(node.key, loc)), bitfield.test(loc));
+      continue;
+    }
+    if(!bitfield.test(loc)) {
+      continue;
+    }
+
+    auto width = info.tile_width;
+    auto x_min = info.x_min + (loc%8)*width;
+    auto y_min = info.y_min + (loc/8)*width;
+
+    auto borders_non_full = [&](std::uint32_t x, std::uint32_t y) {
+      auto address = get_address_wrap(x, y);
+      if(address == -1UL) {
+        return false;
+      }
+      // The structure is canonical, so a tile without a subfield is uniform.
+      return (nodes.find(get_bitfield_key(address, info.layer-1)) != BitfieldNodePool::npos ||
+              !get_field(address, info.layer).test(get_bitfield_loc(address, info.layer)));
+    };
+
+    for(std::uint32_t offset=0; offset<width; offset+=8) {
+      if(borders_non_full(x_min-1, y_min)) {
+        changed_blocks.push_back(get_bitfield_key(get_address(x_min, y_min+offset), 0));
+      }
+      if(borders_non_full(x_min+width, y_min)) {
+        changed_blocks.push_back(get_bitfield_key(get_address(x_min+width-8, y_min+offset), 0));
+      }
+      if(borders_non_full(x_min, y_min-1)) {
+        changed_blocks.push_back(get_bitfield_key(get_address(x_min+offset, y_min), 0));
+      }
+      if(borders_non_full(x_min, y_min+width)) {
+        changed_blocks.push_back(get_bitfield_key(get_address(x_min+offset, y_min+width-8), 0));
+      }
+    }
+  }
+}
+
+std::vector<GrassyBitfield::DrawField> GrassyBitfield::get_draw_fields() const {
+  return get_draw_fields(0, 0, get_size(), get_size(), 1);
+}
+
+std::vector<GrassyBitfield::DrawField> GrassyBitfield::get_draw_fields(
+  std::uint32_t x_min, std::uint32_t y_min,
+  std::uint32_t x_max, std::uint32_t y_max,
+  std::uint32_t min_tile_width) const {
+  // Output is in pre-order, so that each field is drawn before any
+  // of the subfields that lie on top of it.
+  std::vector<DrawField> output;
+  append_draw_fields(nodes.find(top_key()), false,
+                     x_min, y_min, x_max, y_max, min_tile_width, output);
+  return output;
+}
+
+GrassyBitfield::DrawFieldUpdate GrassyBitfield::get_draw_fields_since(std::uint64_t since) const {
+  DrawFieldUpdate output;
+  output.version = version;
+  output.full_refresh = (since < forgotten_version || since > version);
+  if(output.full_refresh) {
+    output.changed = get_draw_fields();
+    return output;
+  }
+
+  auto first_change = std::upper_bound(
+    change_log.begin(), change_log.end(), since,
+    [](std::uint64_t version, const NodeChange& change) {
+      return version < change.version;
+    });
+
+  // Increasing order of key is a pre-order traversal.
+  std::vector<std::uint64_t> keys;
+  for(auto it = first_change; it != change_log.end(); it++) {
+    keys.push_back(it->key);
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  for(auto key : keys) {
+    auto index = find_stored(key);
+    if(index != BitfieldNodePool::npos) {
+      output.changed.push_back(make_draw_field(key, nodes[index].bits));
+    } else {
+      auto info = unpack_bitfield_key(key);
+      output.removed.push_back({info.x_min, info.y_min, info.field_width});
+    }
+  }
+
+  return output;
+}
+
+void GrassyBitfield::append_draw_fields(index_t index, bool parent_value,
+                                        std::uint32_t x_min, std::uint32_t y_min,
+                                        std::uint32_t x_max, std::uint32_t y_max,
+                                        std::uint32_t min_tile_width,
+                                        std::vector<DrawField>& output) const {
+  const auto& node = nodes[index];
+  auto info = unpack_bitfield_key(node.key);
+
+  // Skip fields outside of the viewport.
+  if(std::uint64_t(info.x_min) + info.field_width <= x_min || info.x_min >= x_max ||
+     std::uint64_t(info.y_min) + info.field_width <= y_min || info.y_min >= y_max) {
+    return;
+  }
+
+  Bitfield bitfield = node.stored ? node.bits : Bitfield(parent_value ? -1L : 0);
+
+  // If the subfields would be too detailed, each tile with a
+  // subfield is summarized by whether most of it is filled.
+  if(info.layer > 0 && info.tile_width/8 < min_tile_width) {
+    std::uint64_t tile_area = std::uint64_t(info.tile_width)*info.tile_width;
+    auto child_mask = node.child_mask;
+    while(child_mask) {
+      auto loc = __builtin_ctzll(child_mask);
+      child_mask &= child_mask - 1;
+      const auto& child = nodes[nodes.find(get_subfield_key(node.key, loc))];
+      bitfield.set(loc, 2*child.population >= tile_area);
+    }
+
+    output.push_back(make_draw_field(node.key, bitfield));
+    return;
+  }
+
+  if(node.stored) {
+    output.push_back(make_draw_field(node.key, node.bits));
+  }
+
+  auto child_mask = node.child_mask;
+  while(child_mask) {
+    auto loc = __builtin_ctzll(child_mask);
+    child_mask &= child_mask - 1;
+    append_draw_fields(nodes.find(get_subfield_key(node.key, loc)), bitfield.test(loc),
+                       x_min, y_min, x_max, y_max, min_tile_width, output);
+  }
+}
+
+struct GrassyBitfield::Frozen::Node {
+  std::uint64_t key;
+  bool stored;
+  Planes planes;
+  std::uint64_t child_mask;
+  /// One entry for each bit of child_mask, in order of location.
+  std::vector<std::shared_ptr<const Node>> children;
+
+  /// The subfield at a location, which must be in child_mask.
+  const std::shared_ptr<const Node>& child(unsigned int loc) const {
+    auto lower_locs = child_mask & ((1UL << loc) - 1);
+    return children[__builtin_popcountll(lower_locs)];
+  }
+};
+
+GrassyBitfield::Frozen GrassyBitfield::freeze() {
+  if(!frozen_root || frozen_version < forgotten_version || frozen_version > version) {
+    // The changes since the previous copy are not known, so every
+    // node is copied.
+    frozen_root = freeze_node(nodes.find(top_key()), nullptr, nullptr, nullptr);
+  } else if(frozen_version < version) {
+    std::vector<std::uint64_t> changed;
+    auto first_change = std::upper_bound(
+      change_log.begin(), change_log.end(), frozen_version,
+      [](std::uint64_t v, const NodeChange& change) { return v < change.version; });
+    for(auto it = first_change; it != change_log.end(); it++) {
+      changed.push_back(it->key);
+    }
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+    frozen_root = freeze_node(nodes.find(top_key()), frozen_root.get(),
+                              changed.data(), changed.data() + changed.size());
+  }
+  frozen_version = version;
+
+  Frozen output;
+  output.root = frozen_root;
+  output.num_layers = num_layers;
+  output.num_planes = num_planes;
+  output.edge_wrap = edge_wrap;
+  output.version = version;
+  output.population = num_filled();
+  return output;
+}
+
+std::shared_ptr<const GrassyBitfield::Frozen::Node> GrassyBitfield::freeze_node(
+  index_t index, const Frozen::Node* previous,
+  const std::uint64_t* changed_begin, const std::uint64_t* changed_end) const {
+  // The changed keys are sorted, and all lie within this node.  A
+  // subfield whose keys were not changed is unchanged, as any change
+  // to its child mask comes from a change to a node below it.
+  const auto& node = nodes[index];
+  auto output = std::make_shared<Frozen::Node>();
+  output->key = node.key;
+  output->stored = node.stored;
+  output->planes = {};
+  if(node.stored) {
+    for(unsigned int plane=0; plane<num_planes; plane++) {
+      output->planes[plane] = plane_bits(index, plane);
+    }
+  }
+  output->child_mask = node.child_mask;
+  output->children.reserve(__builtin_popcountll(node.child_mask));
+
+  auto layer = get_key_layer(node.key);
+  auto child_mask = node.child_mask;
+  while(child_mask) {
+    auto loc = __builtin_ctzll(child_mask);
+    child_mask &= child_mask - 1;
+    auto child_key = get_subfield_key(node.key, loc);
+
+    // Keys within a subfield share its address, and sort after it.
+    auto subfield_end = (child_key & ~((1UL << (6*layer)) - 1)) + (1UL << (6*layer));
+    auto child_begin = std::lower_bound(changed_begin, changed_end, child_key);
+    auto child_end = std::lower_bound(child_begin, changed_end, subfield_end);
+
+    const Frozen::Node* previous_child = nullptr;
+    if(previous && ((previous->child_mask >> loc) & 1)) {
+      previous_child = previous->child(loc).get();
+    }
+
+    if(previous_child && child_begin == child_end) {
+      output->children.push_back(previous->child(loc));
+    } else {
+      output->children.push_back(freeze_node(nodes.find(child_key), previous_child,
+                                             child_begin, child_end));
+    }
+    changed_begin = child_end;
+  }
+
+  return output;
+}
+
+GrassyBitfield::Frozen::Frozen()
+  : num_layers(0), num_planes(1), edge_wrap(true), version(0), population(0) { }
+
+std::uint32_t GrassyBitfield::Frozen::get_size() const {
+  return 1UL << (3*num_layers);
+}
+
+bool GrassyBitfield::Frozen::get_val(std::uint32_t x, std::uint32_t y,
+                                     unsigned int plane) const {
+  if(plane >= num_planes) {
+    throw std::invalid_argument("plane is out of range");
+  }
+  return (get_level(x, y) >> plane) & 1;
+}
+
+unsigned int GrassyBitfield::Frozen::get_level(std::uint32_t x, std::uint32_t y) const {
+  auto size = get_size();
+  if(!root || ((x >= size || y >= size) && !edge_wrap)) {
+    return 0;
+  }
+  auto address = get_address((x + size) % size, (y + size) % size);
+
+  // The value is held by the lowest stored node.
+  unsigned int level = 0;
+  const Node* node = root.get();
+  while(node) {
+    auto loc = get_bitfield_loc(address, get_key_layer(node->key));
+    if(node->stored) {
+      level = 0;
+      for(unsigned int plane=0; plane<num_planes; plane++) {
+        level |= unsigned(node->planes[plane].test(loc)) << plane;
+      }
+    }
+    node = ((node->child_mask >> loc) & 1) ? node->child(loc).get() : nullptr;
+  }
+  return level;
+}
+
+std::vector<GrassyBitfield::DrawField> GrassyBitfield::Frozen::get_draw_fields() const {
+  std::vector<DrawField> output;
+  if(root) {
+    append_draw_fields(*root, output);
+  }
+  return output;
+}
+
+GrassyBitfield::DrawFieldUpdate
+GrassyBitfield::Frozen::get_draw_fields_since(const Frozen& previous) const {
+  DrawFieldUpdate output;
+  output.version = version;
+  output.full_refresh = (!previous.root || previous.num_layers != num_layers);
+  if(output.full_refresh) {
+    output.changed = get_draw_fields();
+  } else {
+    append_changes(previous.root.get(), root.get(), output);
+  }
+  return output;
+}
+
+void GrassyBitfield::Frozen::append_changes(const Node* previous, const Node* current,
+                                            DrawFieldUpdate& output) {
+  // Either node may be null, if the subfield exists in only one copy.
+  if(previous == current) {
+    return;
+  }
+
+  if(current && current->stored) {
+    if(!(previous && previous->stored && previous->planes[0] == current->planes[0])) {
+      output.changed.push_back(make_draw_field(current->key, current->planes[0]));
+    }
+  } else if(previous && previous->stored) {
+    auto info = unpack_bitfield_key(previous->key);
+    output.removed.push_back({info.x_min, info.y_min, info.field_width});
+  }
+
+  auto previous_mask = previous ? previous->child_mask : 0;
+  auto current_mask = current ? current->child_mask : 0;
+  auto child_mask = previous_mask | current_mask;
+  while(child_mask) {
+    auto loc = __builtin_ctzll(child_mask);
+    child_mask &= child_mask - 1;
+    append_changes(((previous_mask >> loc) & 1) ? previous->child(loc).get() : nullptr,
+                   ((current_mask >> loc) & 1) ? current->child(loc).get() : nullptr,
+                   output);
+  }
+}
+
+void GrassyBitfield::Frozen::append_draw_fields(const Node& node,
+                                                std::vector<DrawField>& output) const {
+  if(node.stored) {
+    output.push_back(make_draw_field(node.key, node.planes[0]));
+  }
+  for(const auto& child : node.children) {
+    append_draw_fields(*child, output);
+  }
+}
+
 std::ostream& operator<<(std::ostream& out, const GrassyBitfield::DrawField& f) {
   out << "(" << f.x_min << ", " << f.y_min << ")"
       << "\t"
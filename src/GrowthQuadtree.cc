@@ -0,0 +1,176 @@
+#include "GrowthQuadtree.hh"
+
+#include <algorithm>
+
+#include "Hash.hh"
+
+namespace {
+  const GrowthQuadtree::node_t no_node = -1;
+}
+
+std::size_t GrowthQuadtree::BranchKeyHash::operator()(const BranchKey& key) const {
+  return mix64(key.low_children ^ mix64(key.high_children));
+}
+
+GrowthQuadtree::GrowthQuadtree() { }
+
+void GrowthQuadtree::clear() {
+  nodes.clear();
+  leaves.clear();
+  branches.clear();
+  results.clear();
+  uniform_nodes[0].clear();
+  uniform_nodes[1].clear();
+}
+
+GrowthQuadtree::node_t GrowthQuadtree::leaf(std::uint64_t bits) {
+  auto it = leaves.find(bits);
+  if(it != leaves.end()) {
+    return it->second;
+  }
+
+  node_t node = nodes.size();
+  nodes.push_back({bits, {0, 0, 0, 0}, leaf_level});
+  leaves[bits] = node;
+  return node;
+}
+
+GrowthQuadtree::node_t GrowthQuadtree::join(node_t low_left, node_t low_right,
+                                            node_t high_left, node_t high_right) {
+  BranchKey key{low_left | (std::uint64_t(low_right) << 32),
+                high_left | (std::uint64_t(high_right) << 32)};
+  auto it = branches.find(key);
+  if(it != branches.end()) {
+    return it->second;
+  }
+
+  node_t node = nodes.size();
+  nodes.push_back({0, {low_left, low_right, high_left, high_right},
+                   nodes[low_left].level + 1});
+  branches[key] = node;
+  return node;
+}
+
+GrowthQuadtree::node_t GrowthQuadtree::uniform(unsigned int level, bool value) {
+  auto& cache = uniform_nodes[value];
+  while(cache.size() <= level) {
+    cache.push_back(no_node);
+  }
+
+  if(cache[level] == no_node) {
+    if(level == leaf_level) {
+      cache[level] = leaf(value ? -1L : 0);
+    } else {
+      auto quarter = uniform(level-1, value);
+      cache[level] = join(quarter, quarter, quarter, quarter);
+    }
+  }
+
+  return cache[level];
+}
+
+bool GrowthQuadtree::is_uniform(node_t node, bool value) {
+  return node == uniform(level(node), value);
+}
+
+GrowthQuadtree::node_t GrowthQuadtree::center(node_t node) {
+  // Leaves cannot be split, so the center of four leaves is
+  // extracted from their bits.
+  if(level(node) == leaf_level + 1) {
+    return advance_base(node, 0);
+  }
+
+  return join(child(child(node, 0), 3),
+              child(child(node, 1), 2),
+              child(child(node, 2), 1),
+              child(child(node, 3), 0));
+}
+
+GrowthQuadtree::node_t GrowthQuadtree::advance(node_t node, unsigned int log2_steps) {
+  auto node_level = level(node);
+
+  // Growth cannot change a completely empty or full region.
+  for(bool value : {false, true}) {
+    if(is_uniform(node, value)) {
+      return uniform(node_level-1, value);
+    }
+  }
+
+  auto memo_key = (std::uint64_t(node) << 6) | log2_steps;
+  auto it = results.find(memo_key);
+  if(it != results.end()) {
+    return it->second;
+  }
+
+  node_t result;
+  if(node_level == leaf_level + 1) {
+    result = advance_base(node, 1 << log2_steps);
+
+  } else {
+    // Split the node into a 4x4 grid of grandchildren, then make the
+    // 9 overlapping nodes of 2x2 grandchildren.
+    node_t grid[4][4];
+    for(unsigned int gy=0; gy<4; gy++) {
+      for(unsigned int gx=0; gx<4; gx++) {
+        grid[gy][gx] = child(child(node, 2*(gy/2) + gx/2), 2*(gy%2) + gx%2);
+      }
+    }
+
+    // At full speed, each stage advances by half the total.
+    // Otherwise, the first stage only takes the center, and all
+    // growth is done by the second stage.
+    bool full_speed = (log2_steps == node_level-2);
+    node_t stage1[3][3];
+    for(unsigned int y=0; y<3; y++) {
+      for(unsigned int x=0; x<3; x++) {
+        auto overlap = join(grid[y][x], grid[y][x+1], grid[y+1][x], grid[y+1][x+1]);
+        stage1[y][x] = full_speed ? advance(overlap, node_level-3) : center(overlap);
+      }
+    }
+
+    node_t stage2[2][2];
+    for(unsigned int y=0; y<2; y++) {
+      for(unsigned int x=0; x<2; x++) {
+        auto overlap = join(stage1[y][x], stage1[y][x+1], stage1[y+1][x], stage1[y+1][x+1]);
+        stage2[y][x] = advance(overlap, full_speed ? node_level-3 : log2_steps);
+      }
+    }
+
+    result = join(stage2[0][0], stage2[0][1], stage2[1][0], stage2[1][1]);
+  }
+
+  results[memo_key] = result;
+  return result;
+}
+
+GrowthQuadtree::node_t GrowthQuadtree::advance_base(node_t node, unsigned int num_steps) {
+  // 16x16 tiles, one row per integer, with x=0 in the lowest bit.
+  std::uint32_t rows[16];
+  for(unsigned int y=0; y<16; y++) {
+    auto left = leaf_bits(child(node, 2*(y/8)));
+    auto right = leaf_bits(child(node, 2*(y/8) + 1));
+    rows[y] = (((left >> 8*(y%8)) & 0xff) |
+               (((right >> 8*(y%8)) & 0xff) << 8));
+  }
+
+  for(unsigned int step=0; step<num_steps; step++) {
+    std::uint32_t next[16];
+    for(unsigned int y=0; y<16; y++) {
+      next[y] = rows[y] | (rows[y] << 1) | (rows[y] >> 1);
+      if(y > 0) {
+        next[y] |= rows[y-1];
+      }
+      if(y < 15) {
+        next[y] |= rows[y+1];
+      }
+      next[y] &= 0xffff;
+    }
+    std::copy(next, next+16, rows);
+  }
+
+  std::uint64_t bits = 0;
+  for(unsigned int y=0; y<8; y++) {
+    bits |= std::uint64_t((rows[y+4] >> 4) & 0xff) << (8*y);
+  }
+  return leaf(bits);
+}
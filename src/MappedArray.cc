@@ -0,0 +1,131 @@
+#include "MappedArray.hh"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+  void throw_errno(const std::string& action) {
+    std::stringstream ss;
+    ss << action << ": " << std::strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+}
+
+MappedBuffer::MappedBuffer()
+  : base(nullptr), num_bytes(0), fd(-1) { }
+
+MappedBuffer::~MappedBuffer() {
+  release();
+}
+
+MappedBuffer::MappedBuffer(MappedBuffer&& other)
+  : base(other.base), num_bytes(other.num_bytes), fd(other.fd) {
+  other.base = nullptr;
+  other.num_bytes = 0;
+  other.fd = -1;
+}
+
+MappedBuffer& MappedBuffer::operator=(MappedBuffer&& other) {
+  if(&other != this) {
+    release();
+    base = other.base;
+    num_bytes = other.num_bytes;
+    fd = other.fd;
+    other.base = nullptr;
+    other.num_bytes = 0;
+    other.fd = -1;
+  }
+  return *this;
+}
+
+void MappedBuffer::release() {
+  if(base) {
+    munmap(base, num_bytes);
+  }
+  if(fd != -1) {
+    close(fd);
+  }
+  base = nullptr;
+  num_bytes = 0;
+  fd = -1;
+}
+
+void* MappedBuffer::map(std::size_t size) {
+  void* output;
+  if(fd == -1) {
+    output = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  } else {
+    output = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+
+  if(output == MAP_FAILED) {
+    throw_errno("Could not map memory");
+  }
+  return output;
+}
+
+void MappedBuffer::map_file(const std::string& path) {
+  int new_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(new_fd == -1) {
+    throw_errno("Could not open " + path);
+  }
+
+  void* new_base = nullptr;
+  if(num_bytes) {
+    if(ftruncate(new_fd, num_bytes) == -1) {
+      close(new_fd);
+      throw_errno("Could not resize " + path);
+    }
+    new_base = mmap(nullptr, num_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, new_fd, 0);
+    if(new_base == MAP_FAILED) {
+      close(new_fd);
+      throw_errno("Could not map " + path);
+    }
+    std::memcpy(new_base, base, num_bytes);
+  }
+
+  auto size = num_bytes;
+  release();
+  base = new_base;
+  num_bytes = size;
+  fd = new_fd;
+}
+
+void MappedBuffer::reserve(std::size_t size) {
+  if(size <= num_bytes) {
+    return;
+  }
+
+  // Round up to whole pages, as the mapping is made of pages anyway.
+  std::size_t page_size = sysconf(_SC_PAGESIZE);
+  size = (size + page_size - 1) / page_size * page_size;
+
+  if(fd == -1) {
+    // New anonymous memory is zero-filled.
+    void* new_base = map(size);
+    if(base) {
+      std::memcpy(new_base, base, num_bytes);
+      munmap(base, num_bytes);
+    }
+    base = new_base;
+  } else {
+    // Extending the file zero-fills it.  The existing contents stay
+    // in the file, so only the mapping needs to be remade.
+    if(ftruncate(fd, size) == -1) {
+      throw_errno("Could not resize mapped file");
+    }
+    void* new_base = map(size);
+    if(base) {
+      munmap(base, num_bytes);
+    }
+    base = new_base;
+  }
+  num_bytes = size;
+}
@@ -0,0 +1,85 @@
+#include "Snapshot.hh"
+
+#include <cerrno>
+#include <stdexcept>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void SnapshotWriter::write_string(const std::string& value) {
+  write<std::uint64_t>(value.size());
+  write_bytes(value.data(), value.size());
+}
+
+void SnapshotWriter::write_bytes(const void* data, std::size_t num_bytes) {
+  out.write(static_cast<const char*>(data), num_bytes);
+  if(!out) {
+    throw std::runtime_error("Could not write snapshot");
+  }
+}
+
+SnapshotReader::SnapshotReader(const std::string& path)
+  : base(nullptr), num_bytes(0), pos(0), mapped(false) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if(fd == -1) {
+    std::stringstream ss;
+    ss << "Could not open " << path << ": " << std::strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  struct stat info;
+  if(fstat(fd, &info) == -1) {
+    close(fd);
+    throw std::runtime_error("Could not read size of " + path);
+  }
+
+  num_bytes = info.st_size;
+  if(num_bytes) {
+    void* map = mmap(nullptr, num_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Could not map " + path);
+    }
+    base = static_cast<const char*>(map);
+    mapped = true;
+  }
+
+  // The mapping remains valid after the file is closed.
+  close(fd);
+}
+
+SnapshotReader::SnapshotReader(const void* data, std::size_t num_bytes)
+  : base(static_cast<const char*>(data)), num_bytes(num_bytes), pos(0), mapped(false) { }
+
+SnapshotReader::~SnapshotReader() {
+  if(mapped) {
+    munmap(const_cast<char*>(base), num_bytes);
+  }
+}
+
+std::string SnapshotReader::read_string() {
+  auto size = read<std::uint64_t>();
+  auto data = static_cast<const char*>(read_bytes(size));
+  return std::string(data, size);
+}
+
+const void* SnapshotReader::read_bytes(std::size_t size) {
+  if(size > num_bytes - pos) {
+    throw std::runtime_error("Snapshot is truncated");
+  }
+  auto output = base + pos;
+  pos += size;
+  return output;
+}
+
+void SnapshotReader::expect(std::uint64_t magic, const std::string& description) {
+  // The magic number is read as a native integer, so this also
+  // catches snapshots written with a different byte order.
+  if(read<std::uint64_t>() != magic) {
+    throw std::runtime_error("Not a " + description + " snapshot, "
+                             "or written on a machine with a different byte order");
+  }
+}
@@ -0,0 +1,98 @@
+#include "ThreadPool.hh"
+
+ThreadPool::ThreadPool(unsigned int num_threads)
+  : running(true), generation(0), current_func(nullptr),
+    num_tasks(0), next_task(0), tasks_done(0), active_workers(0) {
+  for(unsigned int i=1; i<num_threads; i++) {
+    workers.emplace_back([this](){ worker_thread(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(task_mutex);
+    running = false;
+  }
+  task_cv.notify_all();
+  for(auto& worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::parallel_for(std::size_t num_tasks,
+                              const std::function<void(std::size_t)>& func) {
+  if(workers.empty() || num_tasks < 2) {
+    for(std::size_t i=0; i<num_tasks; i++) {
+      func(i);
+    }
+    return;
+  }
+
+  std::lock_guard<std::mutex> caller_lock(caller_mutex);
+  {
+    std::lock_guard<std::mutex> lock(task_mutex);
+    current_func = &func;
+    this->num_tasks = num_tasks;
+    next_task = 0;
+    tasks_done = 0;
+    generation++;
+  }
+  task_cv.notify_all();
+
+  run_tasks(func, num_tasks);
+
+  // Wait for the workers to leave the loop as well, so that none can
+  // take an index from the next loop while still holding this func.
+  std::unique_lock<std::mutex> lock(task_mutex);
+  done_cv.wait(lock, [&]{
+      return tasks_done == num_tasks && active_workers == 0;
+    });
+  current_func = nullptr;
+}
+
+void ThreadPool::worker_thread() {
+  std::uint64_t last_generation = 0;
+  while(true) {
+    std::unique_lock<std::mutex> lock(task_mutex);
+    task_cv.wait(lock, [&]{
+        return !running || (current_func && generation != last_generation);
+      });
+
+    if(!running) {
+      break;
+    }
+
+    last_generation = generation;
+    auto& func = *current_func;
+    auto count = num_tasks;
+    active_workers++;
+    lock.unlock();
+
+    run_tasks(func, count);
+
+    lock.lock();
+    active_workers--;
+    if(active_workers == 0) {
+      done_cv.notify_all();
+    }
+  }
+}
+
+void ThreadPool::run_tasks(const std::function<void(std::size_t)>& func,
+                           std::size_t num_tasks) {
+  std::size_t completed = 0;
+  while(true) {
+    auto i = next_task++;
+    if(i >= num_tasks) {
+      break;
+    }
+    func(i);
+    completed++;
+  }
+
+  if(completed) {
+    std::lock_guard<std::mutex> lock(task_mutex);
+    tasks_done += completed;
+    done_cv.notify_all();
+  }
+}
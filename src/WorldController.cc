@@ -2,12 +2,14 @@
 
 #include <chrono>
 #include <iostream>
+#include <optional>
 
 
 #include "WorldSim.hh"
 
 WorldController::WorldController(WorldSim& sim)
-  : sim(sim), worker_running(true) {
+  : sim(sim), world_replaced(false), worker_running(true),
+    broadcast_world(sim.Freeze()), broadcast_history_start(sim.GetHistoryStart()) {
   sim_thread = std::thread([this](){worker_thread();});
 }
 
@@ -21,7 +23,7 @@ WorldController::~WorldController() {
 ServerResponse WorldController::request(const std::string& command, std::weak_ptr<void> hdl) {
   try {
     return request_maythrow(command, hdl);
-  } catch(std::domain_error& e) {
+  } catch(std::exception& e) {
     std::cout << "Error in parsing: " << e.what() << "\n"
               << command << std::endl;
     return {"", "", hdl};
@@ -29,6 +31,15 @@ ServerResponse WorldController::request(const std::string& command, std::weak_pt
 }
 
 ServerResponse WorldController::request_maythrow(const std::string& command, std::weak_ptr<void> hdl) {
+  // A request for only the full map is answered from the frozen
+  // world, without waiting for the simulation.
+  auto j = json::parse(command);
+  if(j.size() == 1 && j.count("full_map_requested") && j["full_map_requested"]) {
+    std::lock_guard<std::mutex> lock(response_mutex);
+    queue_full_map(hdl);
+    return {"","",hdl};
+  }
+
   std::lock_guard<std::mutex> lock(command_mutex);
   worker_commands.push({command, hdl});
   command_cv.notify_one();
@@ -53,8 +64,8 @@ void WorldController::worker_thread() {
     worker_commands.pop();
     try{
       worker_thread_iter(req);
-    } catch(std::domain_error& e) {
-      std::cout << "Error in parsing: " << e.what() << "\n"
+    } catch(std::exception& e) {
+      std::cout << "Error in handling request: " << e.what() << "\n"
               << req.command << std::endl;
     }
   }
@@ -67,9 +78,6 @@ void WorldController::worker_thread_iter(Request& req) {
   std::cout << "Regular message received" << std::endl;
   std::cout << req.command << std::endl;
 
-  json output_reply;
-  json output_broadcast;
-
   if(j.count("reset_world") &&
      j["reset_world"]) {
     reset_world();
@@ -87,47 +95,155 @@ void WorldController::worker_thread_iter(Request& req) {
     }
   }
 
-  // If we are going to broadcast it to all connections, no need to
-  // send an individual update as well.
-  if(j.count("full_map_requested") &&
-     j["full_map_requested"]) {
-    output_reply["food_dist"] = get_food_dist();
-    output_reply["creatures"] = get_creature_info();
+  bool full_map_requested = (j.count("full_map_requested") &&
+                             j["full_map_requested"]);
+
+  // Reconstructing a past tick needs the history, which is only used
+  // by the simulation thread.  The full map replaces it as the reply.
+  std::optional<PendingResponse> past_map;
+  if(j.count("seek_tick") && !full_map_requested) {
+    past_map = get_past_map(j["seek_tick"], req.requested_by);
   }
 
   std::lock_guard<std::mutex> lock(response_mutex);
-  responses.push({ output_reply.empty() ? "" : output_reply.dump(),
-        output_broadcast.empty() ? "" : output_broadcast.dump() ,
-        req.requested_by});
+  if(full_map_requested) {
+    queue_full_map(req.requested_by);
+  } else if(past_map) {
+    responses.push(std::move(*past_map));
+  }
 }
 
 ServerResponse WorldController::update_check() {
-  std::lock_guard<std::mutex> lock(response_mutex);
-  if(responses.size()) {
-    auto output = std::move(responses.front());
+  PendingResponse pending;
+  {
+    std::lock_guard<std::mutex> lock(response_mutex);
+    if(responses.empty()) {
+      return {"", "", std::weak_ptr<void>()};
+    }
+    pending = std::move(responses.front());
     responses.pop();
-    return output;
-  } else {
-    return {"", "", std::weak_ptr<void>()};
   }
+  return build_response(pending);
 }
 
 void WorldController::broadcast_map_update() {
-  json output_broadcast;
-  output_broadcast["food_dist"] = get_food_dist();
-  output_broadcast["creatures"] = get_creature_info();
+  // Freezing shares every unchanged node, so is cheap.  The JSON is
+  // built later, by build_response.
+  PendingResponse pending{PendingResponse::Kind::Broadcast, {"", "", std::weak_ptr<void>()},
+                          sim.Freeze(), sim.GetHistoryStart(), world_replaced, ""};
+  world_replaced = false;
 
   std::lock_guard<std::mutex> lock(response_mutex);
-  responses.push({"", output_broadcast.dump(), std::weak_ptr<void>()});
+  broadcast_world = pending.world;
+  broadcast_history_start = pending.history_start;
+  responses.push(std::move(pending));
+}
+
+void WorldController::queue_full_map(std::weak_ptr<void> hdl) {
+  responses.push({PendingResponse::Kind::FullMap, {"", "", hdl},
+                  broadcast_world, broadcast_history_start, false, ""});
+}
+
+ServerResponse WorldController::build_response(PendingResponse& pending) {
+  switch(pending.kind) {
+    case PendingResponse::Kind::Ready:
+      return pending.ready;
+
+    case PendingResponse::Kind::Broadcast: {
+      // Every connection has been sent the food as of the previous
+      // broadcast, or later, so only the changes since then are needed.
+      json output;
+      output["food_dist"] = get_food_dist_since(
+        pending.full_refresh ? GrassyBitfield::Frozen() : sent_food, pending.world.food);
+      output["creatures"] = get_creature_info(*pending.world.creatures);
+      output["tick"] = pending.world.tick;
+      output["history_start"] = pending.history_start;
+      sent_food = pending.world.food;
+      return {"", output.dump(), std::weak_ptr<void>()};
+    }
+
+    case PendingResponse::Kind::FullMap:
+      return {get_full_map(pending.world, pending.history_start).dump(), "",
+              pending.ready.respond_to};
+
+    case PendingResponse::Kind::PastMap: {
+      // Sent as a reply to one connection, which then stops displaying
+      // broadcasts until it requests the full map.
+      json output;
+      output["history_start"] = pending.history_start;
+      if(pending.history_error.size()) {
+        output["history_error"] = pending.history_error;
+      } else {
+        output["food_dist"] = get_food_dist(pending.world.food);
+        output["creatures"] = get_creature_info(*pending.world.creatures);
+        output["history_tick"] = pending.world.tick;
+      }
+      return {output.dump(), "", pending.ready.respond_to};
+    }
+  }
+  return {"", "", std::weak_ptr<void>()};
+}
+
+json WorldController::get_full_map(const WorldSim::Frozen& world, std::uint64_t history_start) {
+  json output;
+  output["food_dist"] = get_food_dist(world.food);
+  output["creatures"] = get_creature_info(*world.creatures);
+  output["tick"] = world.tick;
+  output["history_start"] = history_start;
+  return output;
+}
+
+WorldController::PendingResponse
+WorldController::get_past_map(std::uint64_t tick, std::weak_ptr<void> hdl) const {
+  PendingResponse output{PendingResponse::Kind::PastMap, {"", "", hdl},
+                         WorldSim::Frozen(), sim.GetHistoryStart(), false, ""};
+  try {
+    output.world = sim.Seek(tick);
+  } catch(std::out_of_range& e) {
+    output.history_error = e.what();
+  }
+  return output;
 }
 
-json WorldController::get_food_dist() const {
+json WorldController::get_food_dist(const GrassyBitfield::Frozen& food) {
   json output;
 
-  output["size"] = sim.GetSize();
+  output["size"] = food.get_size();
+  output["version"] = food.get_version();
+  output["full_refresh"] = true;
+  output["food_fields"] = pack_food_fields(food.get_draw_fields());
+  output["removed_fields"] = std::vector<json>();
+
+  return output;
+}
 
+json WorldController::get_food_dist_since(const GrassyBitfield::Frozen& previous,
+                                          const GrassyBitfield::Frozen& food) {
+  auto update = food.get_draw_fields_since(previous);
+
+  json output;
+
+  output["size"] = food.get_size();
+  output["version"] = update.version;
+  output["full_refresh"] = update.full_refresh;
+  output["food_fields"] = pack_food_fields(update.changed);
+
+  std::vector<json> removed_fields;
+  for(const auto& field : update.removed) {
+    json packed;
+    packed["x_min"] = field.x_min;
+    packed["y_min"] = field.y_min;
+    packed["width"] = field.width;
+    removed_fields.push_back(packed);
+  }
+  output["removed_fields"] = removed_fields;
+
+  return output;
+}
+
+json WorldController::pack_food_fields(const std::vector<GrassyBitfield::DrawField>& fields) {
   std::vector<json> food_fields;
-  for(const auto& field : sim.GetFoodDrawFields()) {
+  for(const auto& field : fields) {
     json packed;
     packed["x_min"] = field.x_min;
     packed["y_min"] = field.y_min;
@@ -135,22 +251,20 @@ json WorldController::get_food_dist() const {
     packed["values"] = field.values;
     food_fields.push_back(packed);
   }
-  output["food_fields"] = food_fields;
-
-  return output;
+  return json(food_fields);
 }
 
-json WorldController::get_creature_info() const {
+json WorldController::get_creature_info(const std::vector<WorldSim::CreatureInfo>& creatures) {
   std::vector<json> descriptions;
 
-  for(const auto& creature : sim.GetCreatures()) {
+  for(const auto& creature : creatures) {
     json desc;
 
-    desc["x"] = creature.get_position().X();
-    desc["y"] = creature.get_position().Y();
-    desc["direction"] = creature.get_direction();
-    desc["speed"] = creature.get_speed();
-    desc["radius"] = creature.get_radius();
+    desc["x"] = creature.position.X();
+    desc["y"] = creature.position.Y();
+    desc["direction"] = creature.direction;
+    desc["speed"] = creature.speed;
+    desc["radius"] = creature.radius;
 
     descriptions.push_back(desc);
   }
@@ -160,4 +274,6 @@ json WorldController::get_creature_info() const {
 
 void WorldController::reset_world() {
   sim = WorldSim(sim.GetNumLayers());
+  // The next broadcast replaces the old world entirely.
+  world_replaced = true;
 }
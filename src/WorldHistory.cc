@@ -0,0 +1,90 @@
+#include "WorldHistory.hh"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include "Snapshot.hh"
+
+WorldSim::History::History(std::size_t budget_bytes)
+  : budget_bytes(budget_bytes), bytes_used(0) { }
+
+std::size_t WorldSim::History::keyframe_bytes(const Keyframe& keyframe) {
+  return sizeof(Keyframe) + keyframe.world.size();
+}
+
+void WorldSim::History::record(const WorldSim& world) {
+  auto tick = world.tick;
+  bool consecutive = !keyframes.empty() && tick == last_tick() + 1;
+  bool new_keyframe = (!consecutive ||
+                       keyframes.back().num_ticks >= ticks_per_keyframe ||
+                       keyframes.back().settings_version != world.settings_version);
+
+  if(!new_keyframe) {
+    keyframes.back().num_ticks++;
+    return;
+  }
+
+  if(!keyframes.empty() && !consecutive) {
+    // Out of order, so the older ticks no longer lead to this one.
+    keyframes.clear();
+    bytes_used = 0;
+  }
+
+  std::stringstream ss;
+  SnapshotWriter out(ss);
+  world.save(out);
+
+  keyframes.push_back({tick, 1, world.settings_version, ss.str()});
+  bytes_used += keyframe_bytes(keyframes.back());
+  evict();
+}
+
+WorldSim::Frozen WorldSim::History::seek(std::uint64_t tick) const {
+  auto keyframe = std::upper_bound(
+    keyframes.begin(), keyframes.end(), tick,
+    [](std::uint64_t tick, const Keyframe& keyframe) {
+      return tick < keyframe.first_tick;
+    });
+  if(keyframe == keyframes.begin() ||
+     tick - (keyframe-1)->first_tick >= (keyframe-1)->num_ticks) {
+    std::stringstream ss;
+    ss << "Tick " << tick << " is not in the history";
+    throw std::out_of_range(ss.str());
+  }
+  keyframe--;
+
+  SnapshotReader in(keyframe->world.data(), keyframe->world.size());
+  auto world = WorldSim::load(in, FoodStorage::Sparse);
+  world.history = nullptr;
+  while(world.tick < tick) {
+    world.iterate();
+  }
+  return world.Freeze();
+}
+
+std::uint64_t WorldSim::History::first_tick() const {
+  if(keyframes.empty()) {
+    throw std::out_of_range("History is empty");
+  }
+  return keyframes.front().first_tick;
+}
+
+std::uint64_t WorldSim::History::last_tick() const {
+  if(keyframes.empty()) {
+    throw std::out_of_range("History is empty");
+  }
+  return keyframes.back().first_tick + keyframes.back().num_ticks - 1;
+}
+
+void WorldSim::History::set_budget(std::size_t budget_bytes) {
+  this->budget_bytes = budget_bytes;
+  evict();
+}
+
+void WorldSim::History::evict() {
+  while(bytes_used > budget_bytes && keyframes.size() > 1) {
+    bytes_used -= keyframe_bytes(keyframes.front());
+    keyframes.pop_front();
+  }
+}
@@ -1,50 +1,258 @@
 #include "WorldSim.hh"
 
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
 #include "CreatureBrain_Wander.hh"
+#include "Snapshot.hh"
+#include "ThreadPool.hh"
+#include "WorldHistory.hh"
+
+namespace {
+  // Identifies a WorldSim snapshot, and the version of its format.
+  const std::uint64_t snapshot_magic = 0x574452414744494d; // "MIDGARDW"
+  // Version 2 added the tick.
+  // Version 3 added the seed of the random streams of the creatures.
+  // Version 4 added whether the creature lifecycle is enabled, the
+  // energy and id of each creature, the generation of each id slot,
+  // and the free slots.
+  const std::uint32_t snapshot_version = 4;
+}
 
-WorldSim::WorldSim(int num_layers, int random_seed)
+WorldSim::WorldSim(int num_layers, int random_seed, FoodStorage storage)
   : food(num_layers), iterations_per_growth(4), iterations_since_growth(0),
-    generator(random_seed) {
+    generator(random_seed), creature_seed(random_seed), settings_version(0), tick(0),
+    history(std::make_unique<History>(default_history_budget)) {
   initial_food_distribution();
+  choose_food_storage(storage);
   initial_creature_generation();
+  build_creature_grid();
+  record_history();
+}
+
+WorldSim::WorldSim(GrassyBitfield food, FoodStorage storage)
+  : food(std::move(food)), iterations_per_growth(4), iterations_since_growth(0),
+    creature_seed(0), settings_version(0), tick(0),
+    history(std::make_unique<History>(default_history_budget)) {
+  choose_food_storage(storage);
+}
+
+WorldSim::~WorldSim() = default;
+WorldSim::WorldSim(WorldSim&& other) = default;
+WorldSim& WorldSim::operator=(WorldSim&& other) = default;
+
+void WorldSim::Save(const std::string& path) const {
+  auto temp_path = path + ".tmp";
+  {
+    std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+    if(!file) {
+      throw std::runtime_error("Could not open " + temp_path);
+    }
+    SnapshotWriter out(file);
+    save(out);
+  }
+
+  if(std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("Could not replace " + path);
+  }
+}
+
+void WorldSim::save(SnapshotWriter& out) const {
+  out.write(snapshot_magic);
+  out.write(snapshot_version);
+  out.write<std::int32_t>(iterations_per_growth);
+  out.write<std::int32_t>(iterations_since_growth);
+  out.write<std::uint64_t>(tick);
+
+  std::stringstream generator_state;
+  generator_state << generator;
+  out.write_string(generator_state.str());
+  out.write<std::uint64_t>(creature_seed);
+
+  creatures.save(out);
+
+  food.save(out);
+}
+
+WorldSim WorldSim::Load(const std::string& path, FoodStorage storage) {
+  SnapshotReader in(path);
+  auto sim = load(in, storage);
+  sim.record_history();
+  return sim;
+}
+
+WorldSim WorldSim::load(SnapshotReader& in, FoodStorage storage) {
+  in.expect(snapshot_magic, "WorldSim");
+  auto format_version = in.read<std::uint32_t>();
+  if(format_version < 1 || format_version > snapshot_version) {
+    std::stringstream ss;
+    ss << "Unsupported WorldSim snapshot version " << format_version;
+    throw std::runtime_error(ss.str());
+  }
+
+  auto iterations_per_growth = in.read<std::int32_t>();
+  auto iterations_since_growth = in.read<std::int32_t>();
+  std::uint64_t tick = (format_version >= 2) ? in.read<std::uint64_t>() : 0;
+  std::stringstream generator_state(in.read_string());
+  std::uint64_t creature_seed = (format_version >= 3) ? in.read<std::uint64_t>() : 0;
+  auto creatures = CreatureTable::load(in, format_version >= 4);
+
+  WorldSim sim(GrassyBitfield::load(in), storage);
+  sim.iterations_per_growth = iterations_per_growth;
+  sim.iterations_since_growth = iterations_since_growth;
+  generator_state >> sim.generator;
+  sim.creature_seed = creature_seed;
+  sim.creatures = std::move(creatures);
+  sim.tick = tick;
+  sim.build_creature_grid();
+  return sim;
+}
+
+void WorldSim::choose_food_storage(FoodStorage storage) {
+  if(storage == FoodStorage::Dense) {
+    dense_food = std::make_unique<DenseBitfield>(food);
+  } else {
+    dense_food = nullptr;
+  }
+}
+
+void WorldSim::SetNumThreads(int num_threads) {
+  if(num_threads > 1) {
+    thread_pool = std::make_shared<ThreadPool>(num_threads);
+  } else {
+    thread_pool = nullptr;
+  }
+  food.set_thread_pool(thread_pool);
+}
+
+WorldSim::FoodStorage WorldSim::GetFoodStorage() const {
+  return dense_food ? FoodStorage::Dense : FoodStorage::Sparse;
 }
 
 double WorldSim::GetFoodAt(int x, int y) const {
-  return food.get_val(x,y);
+  // Each plane of the food is one bit of its level.
+  double max_level = (1u << food.get_num_planes()) - 1;
+  return food.get_level(x,y) / max_level;
 }
 
 std::vector<GrassyBitfield::DrawField> WorldSim::GetFoodDrawFields() const {
   return food.get_draw_fields();
 }
 
+std::vector<GrassyBitfield::DrawField> WorldSim::GetFoodDrawFields(int x_min, int y_min,
+                                                                   int x_max, int y_max,
+                                                                   int min_tile_width) const {
+  return food.get_draw_fields(x_min, y_min, x_max, y_max, min_tile_width);
+}
+
+GrassyBitfield::DrawFieldUpdate WorldSim::GetFoodDrawFieldsSince(std::uint64_t version) const {
+  return food.get_draw_fields_since(version);
+}
+
+WorldSim::Frozen WorldSim::Freeze() {
+  return {food.freeze(), std::make_shared<std::vector<CreatureInfo>>(creature_info()), tick};
+}
+
+std::vector<WorldSim::CreatureInfo> WorldSim::creature_info() const {
+  std::vector<CreatureInfo> output;
+  output.reserve(creatures.size());
+  for(std::size_t i=0; i<creatures.size(); i++) {
+    output.push_back({creatures.get_position(i), creatures.get_direction(i),
+                      creatures.get_speed(i), creatures.get_radius()});
+  }
+  return output;
+}
+
+WorldSim::Frozen WorldSim::Seek(std::uint64_t tick) const {
+  return history->seek(tick);
+}
+
+std::uint64_t WorldSim::GetHistoryStart() const {
+  return history->first_tick();
+}
+
+std::size_t WorldSim::GetHistoryBudget() const {
+  return history->get_budget();
+}
+
+void WorldSim::SetHistoryBudget(std::size_t bytes) {
+  history->set_budget(bytes);
+}
+
+void WorldSim::SetIterationsPerGrowth(int new_rate) {
+  iterations_per_growth = new_rate;
+  settings_version++;
+}
+
+void WorldSim::SetCreatureLifecycle(bool enabled) {
+  creatures.set_lifecycle(enabled);
+  settings_version++;
+}
+
+void WorldSim::record_history() {
+  // Worlds replayed by the history have none of their own.
+  if(history) {
+    history->record(*this);
+  }
+}
+
 void WorldSim::initial_food_distribution() {
   int num_seeds = 10;
   auto size = food.get_size();
   //Grr, uniform_int_distribution is inclusive at the top?  I get why,
   //but it is different from almost every other usage.
   std::uniform_int_distribution<std::uint32_t> dist(0, size-1);
+  std::vector<GrassyBitfield::Location> seeds;
   for(int i=0; i<num_seeds; i++) {
-    food.set_val( dist(generator), dist(generator), true);
+    auto x = dist(generator);
+    auto y = dist(generator);
+    seeds.push_back({x, y});
   }
+  food.load_tiles(seeds);
 }
 
 void WorldSim::initial_creature_generation() {
   for(int i=0; i<1; i++) {
     auto brain = std::make_unique<CreatureBrain_Wander>();
-    Creature new_creature(std::move(brain));
-    new_creature.set_position({32,32});
-    creatures.push_back(std::move(new_creature));
+    creatures.add(std::move(brain), {32,32});
   }
 }
 
+void WorldSim::SenseFood(double radius, std::vector<CreatureTable::FoodSense>& output) const {
+  // The sparse food is kept up to date even with dense storage.
+  creatures.sense_food(food, radius, output, thread_pool.get());
+}
+
+void WorldSim::build_creature_grid() {
+  creature_grid.build(creatures, food.get_size(), 2*CreatureTable::get_radius());
+}
+
 void WorldSim::iterate() {
   if(iterations_since_growth >= iterations_per_growth) {
-    food.growth_iteration();
+    if(dense_food) {
+      growth_updates.clear();
+      dense_food->growth_iteration(growth_updates);
+      food.apply_updates(growth_updates);
+    } else {
+      food.growth_iteration();
+    }
     iterations_since_growth = 0;
   }
   iterations_since_growth++;
 
-  for(auto& creature : creatures) {
-    creature.update(generator, food);
+  // Every creature sees the food as it was at the start of the
+  // iteration, and all changes are applied together.
+  const TileField& field = dense_food ? static_cast<const TileField&>(*dense_food) : food;
+  food_updates.clear();
+  creatures.update(creature_seed, tick, field, food_updates, thread_pool.get());
+  build_creature_grid();
+  food.apply_updates(food_updates);
+  if(dense_food) {
+    dense_food->apply_updates(food_updates);
   }
+
+  tick++;
+  record_history();
 }
@@ -1,6 +1,20 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
+#include <tuple>
+
+#include "BitfieldNodePool.hh"
 #include "GrassyBitfield.hh"
+#include "Snapshot.hh"
 
 TEST(BitfieldTests, SetSingleVal) {
   GrassyBitfield field(3, false);
@@ -99,6 +113,973 @@ TEST(BitfieldTests, GrassGrowth_From_Level1) {
   EXPECT_EQ(field.num_filled(), 64U + 64U + 4U);
 }
 
+TEST(BitfieldTests, GrassGrowth_From_Level2) {
+  GrassyBitfield field(3);
+
+  for(int x = 64; x<128; x++) {
+    for(int y = 64; y<128; y++) {
+      field.set_val(x,y,true);
+    }
+  }
+
+  EXPECT_EQ(field.num_filled(), 64U*64U);
+
+  field.growth_iteration();
+  EXPECT_EQ(field.num_filled(), 64U*64U + 4U*64U);
+  EXPECT_EQ(field.get_val(63,64), true);
+  EXPECT_EQ(field.get_val(62,64), false);
+}
+
+TEST(BitfieldTests, GrassGrowth_RegrowAfterSet) {
+  GrassyBitfield field(2, true);
+
+  // Growth in a full field does nothing
+  field.growth_iteration();
+  EXPECT_EQ(field.num_filled(), 64U*64U);
+
+  field.set_val(20, 20, false);
+  field.set_val(21, 20, false);
+  EXPECT_EQ(field.num_filled(), 64U*64U - 2U);
+
+  field.growth_iteration();
+  EXPECT_EQ(field.num_filled(), 64U*64U);
+  EXPECT_EQ(field.get_draw_fields().size(), 1U);
+}
+
+TEST(BitfieldTests, GrassGrowth_Parallel) {
+  GrassyBitfield serial(4);
+  GrassyBitfield parallel(4);
+  parallel.set_num_threads(4);
+  EXPECT_EQ(parallel.get_num_threads(), 4U);
+
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<std::uint32_t> dist(0, serial.get_size()-1);
+  for(int i=0; i<50; i++) {
+    auto x = dist(gen);
+    auto y = dist(gen);
+    serial.set_val(x, y, true);
+    parallel.set_val(x, y, true);
+  }
+
+  for(int i=0; i<80; i++) {
+    serial.growth_iteration();
+    parallel.growth_iteration();
+  }
+
+  EXPECT_EQ(serial.num_filled(), parallel.num_filled());
+
+  auto serial_fields = serial.get_draw_fields();
+  auto parallel_fields = parallel.get_draw_fields();
+  ASSERT_EQ(serial_fields.size(), parallel_fields.size());
+  for(unsigned int i=0; i<serial_fields.size(); i++) {
+    EXPECT_EQ(serial_fields[i].x_min, parallel_fields[i].x_min);
+    EXPECT_EQ(serial_fields[i].y_min, parallel_fields[i].y_min);
+    EXPECT_EQ(serial_fields[i].width, parallel_fields[i].width);
+    EXPECT_TRUE(std::equal(&serial_fields[i].values[0][0],
+                           &serial_fields[i].values[0][0] + 64,
+                           &parallel_fields[i].values[0][0]));
+  }
+}
+
+TEST(BitfieldTests, CountInRect) {
+  GrassyBitfield field(3);
+  EXPECT_EQ(field.count_in_rect(0, 0, 512, 512), 0U);
+
+  for(int x = 64; x<128; x++) {
+    for(int y = 64; y<128; y++) {
+      field.set_val(x,y,true);
+    }
+  }
+  field.set_val(5, 5, true);
+  field.set_val(100, 100, false);
+
+  EXPECT_EQ(field.num_filled(), 64U*64U);
+  EXPECT_EQ(field.count_in_rect(0, 0, 512, 512), 64U*64U);
+  EXPECT_EQ(field.count_in_rect(0, 0, 10000, 10000), 64U*64U);
+  EXPECT_EQ(field.count_in_rect(5, 5, 6, 6), 1U);
+  EXPECT_EQ(field.count_in_rect(5, 5, 5, 6), 0U);
+  EXPECT_EQ(field.count_in_rect(60, 60, 70, 70), 36U);
+  EXPECT_EQ(field.count_in_rect(96, 96, 128, 128), 32U*32U - 1U);
+
+  field.growth_iteration();
+  EXPECT_EQ(field.count_in_rect(0, 0, 512, 512), field.num_filled());
+  EXPECT_EQ(field.count_in_rect(63, 64, 64, 128), 64U);
+}
+
+TEST(BitfieldTests, FindNearestSet) {
+  GrassyBitfield field(2);
+  EXPECT_FALSE(field.find_nearest_set(10.5, 10.5, 5));
+
+  field.set_val(12, 10, true);
+  field.set_val(10, 13, true);
+  auto nearest = field.find_nearest_set(10.5, 10.5, 5);
+  ASSERT_TRUE(nearest);
+  EXPECT_EQ(nearest->x, 12U);
+  EXPECT_EQ(nearest->y, 10U);
+
+  // Only tiles strictly within the radius are found
+  EXPECT_FALSE(field.find_nearest_set(10.5, 10.5, 2));
+
+  // Distances wrap around the edges
+  field.set_val(63, 10, true);
+  nearest = field.find_nearest_set(0.5, 10.5, 5);
+  ASSERT_TRUE(nearest);
+  EXPECT_EQ(nearest->x, 63U);
+
+  auto taken = field.take_nearest(10.5, 10.5, 5);
+  ASSERT_TRUE(taken);
+  EXPECT_EQ(field.get_val(12, 10), false);
+  EXPECT_EQ(field.num_filled(), 2U);
+}
+
+TEST(BitfieldTests, FindNearestSet_MatchesBruteForce) {
+  for(bool edge_wrap : {true, false}) {
+    GrassyBitfield field(2, false, edge_wrap);
+    std::mt19937 gen(edge_wrap);
+    std::uniform_int_distribution<std::uint32_t> tile(0, 63);
+    for(int i=0; i<4; i++) {
+      field.set_val(tile(gen), tile(gen), true);
+    }
+    // Growth makes full subfields as well as partially filled ones.
+    for(int i=0; i<12; i++) {
+      field.growth_iteration();
+    }
+
+    auto size = field.get_size();
+    std::uniform_real_distribution<double> coord(0, size);
+    for(int i=0; i<200; i++) {
+      double x = coord(gen);
+      double y = coord(gen);
+      double radius = 20;
+
+      double expected = radius*radius;
+      for(std::uint32_t tx=0; tx<size; tx++) {
+        for(std::uint32_t ty=0; ty<size; ty++) {
+          double dx = std::abs(tx + 0.5 - x);
+          double dy = std::abs(ty + 0.5 - y);
+          if(edge_wrap) {
+            dx = std::min(dx, size - dx);
+            dy = std::min(dy, size - dy);
+          }
+          if(field.get_val(tx, ty)) {
+            expected = std::min(expected, dx*dx + dy*dy);
+          }
+        }
+      }
+
+      auto nearest = field.find_nearest_set(x, y, radius);
+      if(expected < radius*radius) {
+        ASSERT_TRUE(nearest);
+        EXPECT_TRUE(field.get_val(nearest->x, nearest->y));
+        double dx = std::abs(nearest->x + 0.5 - x);
+        double dy = std::abs(nearest->y + 0.5 - y);
+        if(edge_wrap) {
+          dx = std::min(dx, size - dx);
+          dy = std::min(dy, size - dy);
+        }
+        EXPECT_DOUBLE_EQ(dx*dx + dy*dy, expected);
+      } else {
+        EXPECT_FALSE(nearest);
+      }
+    }
+  }
+}
+
+TEST(BitfieldTests, GrassGrowth_MultipleIterations) {
+  for(bool edge_wrap : {true, false}) {
+    for(unsigned int num_layers : {2, 3}) {
+      for(std::uint64_t num_iterations : {5, 8, 37, 100, 300}) {
+        GrassyBitfield stepped(num_layers, false, edge_wrap);
+        GrassyBitfield memoized(num_layers, false, edge_wrap);
+
+        std::mt19937 gen(num_iterations);
+        std::uniform_int_distribution<std::uint32_t> tile(0, stepped.get_size()-1);
+        for(int i=0; i<5; i++) {
+          auto x = tile(gen);
+          auto y = tile(gen);
+          stepped.set_val(x, y, true);
+          memoized.set_val(x, y, true);
+        }
+
+        for(std::uint64_t i=0; i<num_iterations; i++) {
+          stepped.growth_iteration();
+        }
+        memoized.growth_iterations(num_iterations);
+
+        // Growth continues from the same point afterwards.
+        stepped.growth_iteration();
+        memoized.growth_iteration();
+
+        EXPECT_EQ(stepped.num_filled(), memoized.num_filled());
+        auto stepped_fields = stepped.get_draw_fields();
+        auto memoized_fields = memoized.get_draw_fields();
+        ASSERT_EQ(stepped_fields.size(), memoized_fields.size());
+        for(unsigned int i=0; i<stepped_fields.size(); i++) {
+          EXPECT_EQ(stepped_fields[i].x_min, memoized_fields[i].x_min);
+          EXPECT_EQ(stepped_fields[i].y_min, memoized_fields[i].y_min);
+          EXPECT_EQ(stepped_fields[i].width, memoized_fields[i].width);
+          EXPECT_TRUE(std::equal(&stepped_fields[i].values[0][0],
+                                 &stepped_fields[i].values[0][0] + 64,
+                                 &memoized_fields[i].values[0][0]));
+        }
+      }
+    }
+  }
+}
+
+TEST(BitfieldTests, LoadTiles) {
+  for(bool edge_wrap : {true, false}) {
+    for(unsigned int num_layers : {1, 2, 3}) {
+      GrassyBitfield individual(num_layers, false, edge_wrap);
+      GrassyBitfield bulk(num_layers, true, edge_wrap);
+      auto size = individual.get_size();
+
+      // Dense regions give full subfields, sparse regions give
+      // partially filled subfields.
+      std::mt19937 gen(num_layers);
+      std::uniform_int_distribution<std::uint32_t> tile(0, size-1);
+      std::vector<GrassyBitfield::Location> tiles;
+      for(std::uint32_t x=0; x<size/2; x++) {
+        for(std::uint32_t y=0; y<size/4; y++) {
+          tiles.push_back({x, y});
+        }
+      }
+      for(int i=0; i<100; i++) {
+        tiles.push_back({tile(gen), tile(gen)});
+      }
+      std::shuffle(tiles.begin(), tiles.end(), gen);
+
+      std::vector<bool> raster(size*size, false);
+      for(const auto& t : tiles) {
+        individual.set_val(t.x, t.y, true);
+        raster[t.y*size + t.x] = true;
+      }
+      bulk.load_tiles(tiles);
+
+      GrassyBitfield from_raster(num_layers, false, edge_wrap);
+      from_raster.load_raster(raster);
+
+      for(auto* loaded : {&bulk, &from_raster}) {
+        EXPECT_EQ(individual.num_filled(), loaded->num_filled());
+        auto expected_fields = individual.get_draw_fields();
+        auto loaded_fields = loaded->get_draw_fields();
+        ASSERT_EQ(expected_fields.size(), loaded_fields.size());
+        for(unsigned int i=0; i<expected_fields.size(); i++) {
+          EXPECT_EQ(expected_fields[i].x_min, loaded_fields[i].x_min);
+          EXPECT_EQ(expected_fields[i].y_min, loaded_fields[i].y_min);
+          EXPECT_EQ(expected_fields[i].width, loaded_fields[i].width);
+          EXPECT_TRUE(std::equal(&expected_fields[i].values[0][0],
+                                 &expected_fields[i].values[0][0] + 64,
+                                 &loaded_fields[i].values[0][0]));
+        }
+      }
+
+      // Growth continues from the loaded state.
+      individual.growth_iteration();
+      bulk.growth_iteration();
+      EXPECT_EQ(individual.num_filled(), bulk.num_filled());
+    }
+  }
+
+  GrassyBitfield field(2, false, false);
+  EXPECT_THROW(field.load_tiles({{64, 0}}), std::invalid_argument);
+  EXPECT_THROW(field.load_raster(std::vector<bool>(10)), std::invalid_argument);
+}
+
+TEST(BitfieldTests, RegionOperations) {
+  for(bool edge_wrap : {true, false}) {
+    GrassyBitfield field(2, false, edge_wrap);
+    GrassyBitfield other(2, false, edge_wrap);
+    auto size = field.get_size();
+
+    std::mt19937 gen(edge_wrap);
+    std::uniform_int_distribution<std::uint32_t> tile(0, size-1);
+    for(int i=0; i<6; i++) {
+      field.set_val(tile(gen), tile(gen), true);
+      other.set_val(tile(gen), tile(gen), true);
+    }
+    for(int i=0; i<10; i++) {
+      field.growth_iteration();
+      other.growth_iteration();
+    }
+
+    std::vector<bool> expected(size*size);
+    std::vector<bool> other_values(size*size);
+    for(std::uint32_t y=0; y<size; y++) {
+      for(std::uint32_t x=0; x<size; x++) {
+        expected[y*size + x] = field.get_val(x, y);
+        other_values[y*size + x] = other.get_val(x, y);
+      }
+    }
+
+    auto check = [&]() {
+      std::uint64_t num_filled = 0;
+      for(std::uint32_t y=0; y<size; y++) {
+        for(std::uint32_t x=0; x<size; x++) {
+          ASSERT_EQ(field.get_val(x, y), expected[y*size + x]);
+          num_filled += expected[y*size + x];
+        }
+      }
+      EXPECT_EQ(field.num_filled(), num_filled);
+    };
+
+    field.fill_rect(3, 5, 40, 1000);
+    for(std::uint32_t y=5; y<size; y++) {
+      for(std::uint32_t x=3; x<40; x++) {
+        expected[y*size + x] = true;
+      }
+    }
+    check();
+
+    field.clear_rect(0, 8, 64, 24);
+    for(std::uint32_t y=8; y<24; y++) {
+      for(std::uint32_t x=0; x<size; x++) {
+        expected[y*size + x] = false;
+      }
+    }
+    check();
+
+    double disk_x = 2.3;
+    double disk_y = 50.7;
+    double radius = 9.5;
+    field.fill_disk(disk_x, disk_y, radius);
+    for(std::uint32_t y=0; y<size; y++) {
+      for(std::uint32_t x=0; x<size; x++) {
+        double dx = std::abs(x + 0.5 - disk_x);
+        double dy = std::abs(y + 0.5 - disk_y);
+        if(edge_wrap) {
+          dx = std::min(dx, size - dx);
+          dy = std::min(dy, size - dy);
+        }
+        if(dx*dx + dy*dy < radius*radius) {
+          expected[y*size + x] = true;
+        }
+      }
+    }
+    check();
+
+    auto saved = expected;
+    GrassyBitfield copy = field;
+
+    field.union_with(other);
+    for(unsigned int i=0; i<expected.size(); i++) {
+      expected[i] = saved[i] || other_values[i];
+    }
+    check();
+
+    field = copy;
+    field.intersect_with(other);
+    for(unsigned int i=0; i<expected.size(); i++) {
+      expected[i] = saved[i] && other_values[i];
+    }
+    check();
+
+    field = copy;
+    field.subtract(other);
+    for(unsigned int i=0; i<expected.size(); i++) {
+      expected[i] = saved[i] && !other_values[i];
+    }
+    check();
+
+    field.subtract(field);
+    EXPECT_EQ(field.num_filled(), 0U);
+  }
+
+  GrassyBitfield small(2);
+  GrassyBitfield large(3);
+  EXPECT_THROW(small.union_with(large), std::invalid_argument);
+}
+
+TEST(BitfieldTests, ApplyUpdates) {
+  for(bool edge_wrap : {true, false}) {
+    GrassyBitfield individual(3, false, edge_wrap);
+    GrassyBitfield batched(3, false, edge_wrap);
+    auto size = individual.get_size();
+
+    std::mt19937 gen(edge_wrap);
+    std::uniform_int_distribution<std::uint32_t> tile(0, size-1);
+    for(int i=0; i<10; i++) {
+      auto x = tile(gen);
+      auto y = tile(gen);
+      individual.set_val(x, y, true);
+      batched.set_val(x, y, true);
+    }
+    for(int i=0; i<20; i++) {
+      individual.growth_iteration();
+      batched.growth_iteration();
+    }
+
+    for(int round=0; round<5; round++) {
+      // Concentrated updates, so that tiles are updated repeatedly
+      // and blocks become uniform.
+      std::uniform_int_distribution<std::uint32_t> near(0, 40);
+      std::bernoulli_distribution fill(0.5);
+      std::vector<GrassyBitfield::TileUpdate> updates;
+      for(int i=0; i<3000; i++) {
+        updates.push_back({near(gen), near(gen), fill(gen)});
+      }
+      for(int i=0; i<200; i++) {
+        updates.push_back({tile(gen), tile(gen), fill(gen)});
+      }
+
+      for(const auto& update : updates) {
+        individual.set_val(update.x, update.y, update.value);
+      }
+      batched.apply_updates(updates);
+
+      individual.growth_iteration();
+      batched.growth_iteration();
+
+      EXPECT_EQ(individual.num_filled(), batched.num_filled());
+      for(std::uint32_t y=0; y<size; y++) {
+        for(std::uint32_t x=0; x<size; x++) {
+          ASSERT_EQ(individual.get_val(x, y), batched.get_val(x, y));
+        }
+      }
+    }
+  }
+
+  GrassyBitfield field(2, false, false);
+  EXPECT_THROW(field.apply_updates({{0, 64, true}}), std::invalid_argument);
+}
+
+TEST(BitfieldTests, DrawFieldsSince) {
+  GrassyBitfield field(3);
+  auto size = field.get_size();
+
+  // Fields held by a viewer that only receives the changes.
+  using Viewer = std::map<std::tuple<std::uint32_t, std::uint32_t, std::uint32_t>,
+                          GrassyBitfield::DrawField>;
+  Viewer viewer;
+  std::uint64_t viewer_version = -1;
+  int num_full_refreshes = 0;
+
+  // A viewer that receives the changes between frozen copies.
+  Viewer frozen_viewer;
+  GrassyBitfield::Frozen frozen;
+  int num_frozen_updates = 0;
+
+  auto apply = [](Viewer& viewer, const GrassyBitfield::DrawFieldUpdate& update) {
+    if(update.full_refresh) {
+      viewer.clear();
+    }
+    for(const auto& removed : update.removed) {
+      viewer.erase(std::make_tuple(removed.x_min, removed.y_min, removed.width));
+    }
+    for(const auto& changed : update.changed) {
+      viewer[std::make_tuple(changed.x_min, changed.y_min, changed.width)] = changed;
+    }
+  };
+
+  auto check = [&]() {
+    auto update = field.get_draw_fields_since(viewer_version);
+    viewer_version = update.version;
+    num_full_refreshes += update.full_refresh;
+    apply(viewer, update);
+
+    auto next_frozen = field.freeze();
+    auto frozen_update = next_frozen.get_draw_fields_since(frozen);
+    // Only the first update, from an empty copy, is a full refresh.
+    EXPECT_EQ(frozen_update.full_refresh, num_frozen_updates++ == 0);
+    EXPECT_EQ(frozen_update.version, field.get_version());
+    apply(frozen_viewer, frozen_update);
+    frozen = next_frozen;
+
+    auto expected = field.get_draw_fields();
+    for(const auto* received : {&viewer, &frozen_viewer}) {
+      ASSERT_EQ(received->size(), expected.size());
+      for(const auto& f : expected) {
+        auto it = received->find(std::make_tuple(f.x_min, f.y_min, f.width));
+        ASSERT_NE(it, received->end());
+        EXPECT_TRUE(std::equal(&f.values[0][0], &f.values[0][0] + 64,
+                               &it->second.values[0][0]));
+      }
+    }
+  };
+
+  check();
+  EXPECT_EQ(num_full_refreshes, 1);
+
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<std::uint32_t> tile(0, size-1);
+  for(int i=0; i<10; i++) {
+    field.set_val(tile(gen), tile(gen), true);
+  }
+  check();
+
+  for(int i=0; i<30; i++) {
+    field.growth_iteration();
+    field.take_nearest(tile(gen), tile(gen), 50);
+    if(i%5 == 0) {
+      check();
+    }
+  }
+  check();
+
+  // A single change gives a single changed field.
+  auto version = field.get_version();
+  field.set_val(3, 3, !field.get_val(3, 3));
+  auto update = field.get_draw_fields_since(version);
+  EXPECT_FALSE(update.full_refresh);
+  EXPECT_EQ(update.changed.size() + update.removed.size(), 1U);
+  check();
+  EXPECT_EQ(num_full_refreshes, 1);
+
+  // Only a limited history is kept.
+  for(int i=0; i<10000; i++) {
+    field.set_val(3, 3, !field.get_val(3, 3));
+  }
+  EXPECT_TRUE(field.get_draw_fields_since(version).full_refresh);
+  EXPECT_FALSE(field.get_draw_fields_since(field.get_version() - 10).full_refresh);
+
+  // Rebuilding the field requires a full refresh.
+  field.fill_rect(0, 0, 100, 100);
+  check();
+  EXPECT_EQ(num_full_refreshes, 2);
+  EXPECT_TRUE(field.get_draw_fields_since(0).full_refresh);
+}
+
+TEST(BitfieldTests, DrawFieldsInViewport) {
+  GrassyBitfield field(3);
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<std::uint32_t> tile(0, field.get_size()-1);
+  for(int i=0; i<20; i++) {
+    field.set_val(tile(gen), tile(gen), true);
+  }
+  for(int i=0; i<15; i++) {
+    field.growth_iteration();
+  }
+
+  auto all_fields = field.get_draw_fields();
+  EXPECT_EQ(field.get_draw_fields(0, 0, 512, 512, 1).size(), all_fields.size());
+
+  // Only fields overlapping the viewport are returned.
+  auto in_view = field.get_draw_fields(100, 200, 300, 250, 1);
+  unsigned int expected_in_view = 0;
+  for(const auto& f : all_fields) {
+    if(f.x_min + f.width > 100 && f.x_min < 300 &&
+       f.y_min + f.width > 200 && f.y_min < 250) {
+      expected_in_view++;
+    }
+  }
+  EXPECT_EQ(in_view.size(), expected_in_view);
+  EXPECT_LT(in_view.size(), all_fields.size());
+
+  // Tiles narrower than 8 are summarized by the majority value.
+  auto coarse = field.get_draw_fields(0, 0, 512, 512, 8);
+  EXPECT_LT(coarse.size(), all_fields.size());
+  for(const auto& f : coarse) {
+    EXPECT_GE(f.width, 64U);
+    if(f.width == 64) {
+      for(std::uint32_t y=0; y<8; y++) {
+        for(std::uint32_t x=0; x<8; x++) {
+          auto count = field.count_in_rect(f.x_min + 8*x, f.y_min + 8*y,
+                                           f.x_min + 8*x + 8, f.y_min + 8*y + 8);
+          EXPECT_EQ(f.values[y][x], 2*count >= 64);
+        }
+      }
+    }
+  }
+}
+
+TEST(BitfieldTests, MultiplePlanes) {
+  for(bool edge_wrap : {true, false}) {
+    GrassyBitfield field(2, false, edge_wrap, 3);
+    std::vector<GrassyBitfield> separate;
+    for(unsigned int plane=0; plane<3; plane++) {
+      separate.emplace_back(2, false, edge_wrap);
+    }
+
+    auto expect_equal = [&]() {
+      for(std::uint32_t y=0; y<field.get_size(); y++) {
+        for(std::uint32_t x=0; x<field.get_size(); x++) {
+          unsigned int level = 0;
+          for(unsigned int plane=0; plane<3; plane++) {
+            ASSERT_EQ(field.get_val(x, y, plane), separate[plane].get_val(x, y));
+            level |= separate[plane].get_val(x, y) << plane;
+          }
+          ASSERT_EQ(field.get_level(x, y), level);
+        }
+      }
+      EXPECT_EQ(field.num_filled(), separate[0].num_filled());
+    };
+
+    std::mt19937 gen(edge_wrap);
+    std::uniform_int_distribution<std::uint32_t> tile(0, field.get_size()-1);
+    for(int i=0; i<30; i++) {
+      auto x = tile(gen);
+      auto y = tile(gen);
+      auto plane = gen() % 3;
+      field.set_val(x, y, true, plane);
+      separate[plane].set_val(x, y, true);
+    }
+    expect_equal();
+
+    for(int i=0; i<10; i++) {
+      auto x = tile(gen);
+      auto y = tile(gen);
+      unsigned int level = gen() % 8;
+      field.set_level(x, y, level);
+      for(unsigned int plane=0; plane<3; plane++) {
+        separate[plane].set_val(x, y, (level >> plane) & 1);
+      }
+    }
+    expect_equal();
+
+    // Each plane grows independently.
+    for(int i=0; i<4; i++) {
+      field.growth_iteration();
+      for(auto& plane : separate) {
+        plane.growth_iteration();
+      }
+    }
+    expect_equal();
+
+    field.growth_iterations(20);
+    for(auto& plane : separate) {
+      plane.growth_iterations(20);
+    }
+    expect_equal();
+
+    // Once every plane is full, the field collapses to the top node.
+    field.growth_iterations(64);
+    EXPECT_EQ(field.get_level(17, 40), 7U);
+    EXPECT_EQ(field.get_draw_fields().size(), 1U);
+  }
+
+  GrassyBitfield field(2, false, true, 2);
+  EXPECT_THROW(field.set_val(0, 0, true, 2), std::invalid_argument);
+  EXPECT_THROW(field.set_level(0, 0, 4), std::invalid_argument);
+  EXPECT_THROW(field.load_tiles({{1, 1}}), std::logic_error);
+  EXPECT_THROW(GrassyBitfield(2, false, true, 5), std::invalid_argument);
+}
+
+TEST(BitfieldTests, GrassGrowth_Stochastic) {
+  auto make_field = [](double probability, std::uint64_t seed, unsigned int num_threads) {
+    GrassyBitfield field(3);
+    std::mt19937 gen(0);
+    std::uniform_int_distribution<std::uint32_t> tile(0, field.get_size()-1);
+    for(int i=0; i<20; i++) {
+      field.set_val(tile(gen), tile(gen), true);
+    }
+    field.set_growth_probability(probability);
+    field.set_growth_seed(seed);
+    field.set_num_threads(num_threads);
+    field.growth_iterations(40);
+    return field;
+  };
+
+  auto deterministic = make_field(1, 0, 1);
+  auto stochastic = make_field(0.5, 12345, 1);
+  EXPECT_EQ(stochastic.get_growth_probability(), 0.5);
+  EXPECT_GT(stochastic.num_filled(), 20U);
+  EXPECT_LT(stochastic.num_filled(), deterministic.num_filled());
+
+  // The result depends only on the seed.
+  auto repeated = make_field(0.5, 12345, 4);
+  EXPECT_EQ(repeated.num_filled(), stochastic.num_filled());
+  auto expected_fields = stochastic.get_draw_fields();
+  auto repeated_fields = repeated.get_draw_fields();
+  ASSERT_EQ(repeated_fields.size(), expected_fields.size());
+  for(unsigned int i=0; i<expected_fields.size(); i++) {
+    EXPECT_EQ(repeated_fields[i].x_min, expected_fields[i].x_min);
+    EXPECT_EQ(repeated_fields[i].y_min, expected_fields[i].y_min);
+    EXPECT_TRUE(std::equal(&repeated_fields[i].values[0][0],
+                           &repeated_fields[i].values[0][0] + 64,
+                           &expected_fields[i].values[0][0]));
+  }
+  EXPECT_NE(make_field(0.5, 54321, 1).num_filled(), stochastic.num_filled());
+
+  EXPECT_EQ(make_field(0, 0, 1).num_filled(), 20U);
+  EXPECT_THROW(stochastic.set_growth_probability(1.5), std::invalid_argument);
+
+  // Blocks that did not grow by chance still grow later.
+  GrassyBitfield field(2);
+  field.set_val(10, 10, true);
+  field.set_growth_probability(0.1);
+  field.growth_iterations(2000);
+  EXPECT_EQ(field.num_filled(), 64U*64U);
+}
+
+TEST(BitfieldTests, MapToFile) {
+  auto path = (std::filesystem::temp_directory_path() / "BitfieldTests_MapToFile").string();
+
+  GrassyBitfield in_memory(3);
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<std::uint32_t> tile(0, in_memory.get_size()-1);
+  for(int i=0; i<20; i++) {
+    in_memory.set_val(tile(gen), tile(gen), true);
+  }
+  in_memory.growth_iterations(5);
+
+  {
+    GrassyBitfield mapped = in_memory;
+    mapped.map_to_file(path);
+    EXPECT_TRUE(std::filesystem::exists(path + ".nodes"));
+
+    auto check_equal = [&]() {
+      ASSERT_EQ(mapped.num_filled(), in_memory.num_filled());
+      for(std::uint32_t y=0; y<mapped.get_size(); y+=3) {
+        for(std::uint32_t x=0; x<mapped.get_size(); x+=3) {
+          ASSERT_EQ(mapped.get_val(x, y), in_memory.get_val(x, y));
+        }
+      }
+    };
+    check_equal();
+
+    // Growth after reordering follows the updated neighbor links.
+    for(auto* field : {&mapped, &in_memory}) {
+      for(int i=0; i<10; i++) {
+        field->growth_iteration();
+      }
+      field->clear_rect(100, 100, 300, 200);
+      field->set_val(150, 150, true);
+      field->growth_iterations(20);
+    }
+    mapped.reorder_nodes();
+    for(auto* field : {&mapped, &in_memory}) {
+      field->growth_iteration();
+    }
+    check_equal();
+  }
+
+  for(auto suffix : {".nodes", ".planes"}) {
+    std::filesystem::remove(path + suffix);
+  }
+}
+
+TEST(BitfieldTests, Snapshot) {
+  auto path = (std::filesystem::temp_directory_path() / "BitfieldTests_Snapshot").string();
+
+  for(unsigned int num_planes : {1, 2}) {
+    GrassyBitfield field(3, false, false, num_planes);
+    std::mt19937 gen(num_planes);
+    std::uniform_int_distribution<std::uint32_t> tile(0, field.get_size()-1);
+    for(int i=0; i<30; i++) {
+      field.set_val(tile(gen), tile(gen), true, gen() % num_planes);
+    }
+    field.set_growth_probability(0.75);
+    field.set_growth_seed(3);
+    field.growth_iterations(10);
+
+    {
+      std::ofstream file(path, std::ios::binary);
+      SnapshotWriter out(file);
+      field.save(out);
+    }
+    SnapshotReader in(path);
+    auto loaded = GrassyBitfield::load(in);
+
+    EXPECT_EQ(loaded.get_num_planes(), num_planes);
+    EXPECT_EQ(loaded.get_growth_probability(), 0.75);
+    EXPECT_TRUE(loaded.get_draw_fields_since(field.get_version() - 1).full_refresh);
+
+    // Growth continues from the same blocks, with the same random choices.
+    field.growth_iterations(10);
+    loaded.growth_iterations(10);
+    ASSERT_EQ(loaded.num_filled(), field.num_filled());
+    for(std::uint32_t y=0; y<field.get_size(); y+=2) {
+      for(std::uint32_t x=0; x<field.get_size(); x+=2) {
+        ASSERT_EQ(loaded.get_level(x, y), field.get_level(x, y));
+      }
+    }
+  }
+
+  {
+    std::ofstream file(path, std::ios::binary);
+    file << "not a snapshot";
+  }
+  SnapshotReader in(path);
+  EXPECT_THROW(GrassyBitfield::load(in), std::runtime_error);
+  std::filesystem::remove(path);
+}
+
+TEST(BitfieldTests, CorruptSnapshot) {
+  GrassyBitfield field(3);
+  field.load_tiles({{3, 4}, {100, 200}, {300, 500}});
+  field.growth_iterations(5);
+
+  std::ostringstream stream;
+  {
+    SnapshotWriter out(stream);
+    field.save(out);
+  }
+  const std::string valid = stream.str();
+
+  // The nodes are the last block of the snapshot, after their count.
+  using Node = BitfieldNodePool::Node;
+  std::size_t num_nodes = 0;
+  for(std::size_t n=1; n*sizeof(Node) + 8 <= valid.size(); n++) {
+    std::uint64_t count;
+    std::memcpy(&count, valid.data() + valid.size() - n*sizeof(Node) - 8, 8);
+    if(count == n) {
+      num_nodes = n;
+      break;
+    }
+  }
+  ASSERT_GT(num_nodes, 0U);
+  auto count_pos = valid.size() - num_nodes*sizeof(Node) - 8;
+  auto node_pos = [&](std::size_t i) { return count_pos + 8 + i*sizeof(Node); };
+
+  auto load = [](const std::string& data) {
+    SnapshotReader in(data.data(), data.size());
+    return GrassyBitfield::load(in);
+  };
+  auto with_value = [&](std::size_t pos, auto value) {
+    auto data = valid;
+    std::memcpy(&data[pos], &value, sizeof(value));
+    return data;
+  };
+
+  EXPECT_NO_THROW(load(valid));
+  EXPECT_THROW(load(valid.substr(0, valid.size() - 1)), std::runtime_error);
+  EXPECT_THROW(load(with_value(count_pos, std::uint64_t(1) << 60)), std::runtime_error);
+  EXPECT_THROW(load(with_value(count_pos, std::uint64_t(-1))), std::runtime_error);
+  for(std::size_t i=0; i<num_nodes; i++) {
+    auto neighbors = node_pos(i) + offsetof(Node, neighbors);
+    EXPECT_THROW(load(with_value(neighbors, std::uint32_t(num_nodes))), std::runtime_error);
+    EXPECT_THROW(load(with_value(node_pos(i), std::uint64_t(0xabcdef))), std::runtime_error);
+    EXPECT_THROW(load(with_value(node_pos(i) + offsetof(Node, child_mask), std::uint64_t(-1))),
+                 std::runtime_error);
+  }
+}
+
+TEST(BitfieldTests, Freeze) {
+  GrassyBitfield field(3, false, true, 2);
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<std::uint32_t> tile(0, field.get_size()-1);
+
+  auto expect_equal = [&](const GrassyBitfield::Frozen& frozen,
+                          const std::vector<unsigned int>& levels) {
+    for(std::uint32_t y=0; y<field.get_size(); y++) {
+      for(std::uint32_t x=0; x<field.get_size(); x++) {
+        ASSERT_EQ(frozen.get_level(x, y), levels[y*field.get_size() + x]);
+      }
+    }
+  };
+  auto current_levels = [&]() {
+    std::vector<unsigned int> levels;
+    for(std::uint32_t y=0; y<field.get_size(); y++) {
+      for(std::uint32_t x=0; x<field.get_size(); x++) {
+        levels.push_back(field.get_level(x, y));
+      }
+    }
+    return levels;
+  };
+
+  std::vector<GrassyBitfield::Frozen> copies;
+  std::vector<std::vector<unsigned int>> copy_levels;
+  for(int step=0; step<12; step++) {
+    for(int i=0; i<20; i++) {
+      field.set_val(tile(gen), tile(gen), gen() % 3 == 0, gen() % 2);
+    }
+    field.growth_iteration();
+
+    copies.push_back(field.freeze());
+    copy_levels.push_back(current_levels());
+    EXPECT_EQ(copies.back().get_version(), field.get_version());
+    EXPECT_EQ(copies.back().num_filled(), field.num_filled());
+    EXPECT_EQ(copies.back().get_draw_fields().size(), field.get_draw_fields().size());
+  }
+
+  // Earlier copies are unaffected by later changes.
+  for(unsigned int i=0; i<copies.size(); i++) {
+    expect_equal(copies[i], copy_levels[i]);
+  }
+}
+
+TEST(BitfieldTests, SectorAndRay) {
+  const double pi = 3.14159265358979323846;
+  std::mt19937 gen(25);
+  for(bool edge_wrap : {true, false}) {
+    GrassyBitfield field(2, false, edge_wrap);
+    double size = field.get_size();
+    field.load_tiles({{3, 4}, {40, 40}, {60, 10}});
+    for(int i=0; i<6; i++) {
+      field.growth_iteration();
+    }
+    field.fill_rect(16, 32, 32, 48);
+
+    std::uniform_real_distribution<double> pos(0, size);
+    std::uniform_real_distribution<double> angle(-pi, pi);
+    for(int query=0; query<200; query++) {
+      double x = pos(gen);
+      double y = pos(gen);
+      double direction = angle(gen);
+      double half_angle = std::uniform_real_distribution<double>(0, 3.3)(gen);
+      double radius = std::uniform_real_distribution<double>(0, 40)(gen);
+
+      std::uint64_t expected = 0;
+      for(std::uint32_t tile_y=0; tile_y<size; tile_y++) {
+        for(std::uint32_t tile_x=0; tile_x<size; tile_x++) {
+          double dx = tile_x + 0.5 - x;
+          double dy = tile_y + 0.5 - y;
+          if(edge_wrap) {
+            dx = std::fmod(dx + 1.5*size, size) - size/2;
+            dy = std::fmod(dy + 1.5*size, size) - size/2;
+          }
+          if(field.get_val(tile_x, tile_y) && dx*dx + dy*dy < radius*radius &&
+             std::abs(std::remainder(std::atan2(dy, dx) - direction, 2*pi)) <= half_angle) {
+            expected++;
+          }
+        }
+      }
+      EXPECT_EQ(field.count_in_sector(x, y, radius, direction, half_angle), expected);
+
+      // Small steps along the ray find the same tile.
+      const double step = 1e-3;
+      std::optional<double> marched;
+      for(double dist=0; dist<=radius; dist+=step) {
+        double ray_x = x + dist*std::cos(direction);
+        double ray_y = y + dist*std::sin(direction);
+        if(!edge_wrap && (ray_x < 0 || ray_y < 0 || ray_x >= size || ray_y >= size)) {
+          break;
+        }
+        if(field.get_val(std::floor(std::fmod(ray_x + size, size)),
+                         std::floor(std::fmod(ray_y + size, size)))) {
+          marched = dist;
+          break;
+        }
+      }
+      auto cast = field.cast_ray(x, y, direction, radius);
+      if(cast && marched) {
+        EXPECT_NEAR(*cast, *marched, 2*step);
+      } else if(cast) {
+        EXPECT_GT(*cast, radius - 2*step);
+      } else if(marched) {
+        EXPECT_GT(*marched, radius - 2*step);
+      }
+    }
+  }
+
+  // A full field is counted without visiting each tile.
+  GrassyBitfield full(3, true);
+  // Tiles with centers strictly inside the circle.
+  EXPECT_EQ(full.count_in_sector(100.5, 100.5, 10, 0, pi), 305U);
+  EXPECT_EQ(full.cast_ray(100.5, 100.5, 1, 10), 0.0);
+  EXPECT_FALSE(GrassyBitfield(3).cast_ray(100.5, 100.5, 1, 1000));
+
+  // Rays that wrap around the field stop, even with no limit.
+  const double infinity = std::numeric_limits<double>::infinity();
+  EXPECT_FALSE(GrassyBitfield(3).cast_ray(100.5, 100.5, 1, infinity));
+  GrassyBitfield one_tile(2);
+  one_tile.set_val(5, 5, true);
+  EXPECT_FALSE(one_tile.cast_ray(0.5, 0.5, 0, infinity));
+  EXPECT_FALSE(one_tile.cast_ray(0.5, 0.5, pi/2, infinity));
+  auto diagonal = one_tile.cast_ray(1.5, 0.5, 1, infinity);
+  EXPECT_LE(diagonal.value_or(0), 2*64.0);
+
+  // On a large, sparse field, a ray that misses the only filled tile
+  // stops after a few laps' worth of blocks, rather than circling
+  // until the position loses precision.
+  GrassyBitfield sparse(7);
+  sparse.set_val(1000000, 1000000, true);
+  EXPECT_FALSE(sparse.cast_ray(0.5, 0.5, pi/2, infinity));
+  EXPECT_FALSE(sparse.cast_ray(0.5, 0.5, pi, infinity));
+  EXPECT_FALSE(sparse.cast_ray(0.5, 0.5, 1e-9, infinity));
+  EXPECT_EQ(sparse.cast_ray(1000000.5, 0.5, pi/2, infinity), 999999.5);
+}
+
 // TEST(BitfieldTests, GrassGrowth) {
 //   GrassyBitfield field(2);
 //   field.set_val(4,7,true);
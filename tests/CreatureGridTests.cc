@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "CreatureBrain_Wander.hh"
+#include "CreatureGrid.hh"
+#include "CreatureTable.hh"
+
+namespace {
+  double toroidal_dist2(GVector<2> a, double x, double y, double world_size) {
+    double dx = std::abs(a.X() - x);
+    double dy = std::abs(a.Y() - y);
+    dx = std::min(dx, world_size - dx);
+    dy = std::min(dy, world_size - dy);
+    return dx*dx + dy*dy;
+  }
+}
+
+TEST(CreatureGridTests, MatchesBruteForce) {
+  const double world_size = 64;
+  std::mt19937 gen(4);
+  std::uniform_real_distribution<double> pos(0, world_size);
+
+  for(int num_creatures : {0, 1, 10, 500}) {
+    CreatureTable creatures;
+    for(int i=0; i<num_creatures; i++) {
+      creatures.add(std::make_unique<CreatureBrain_Wander>(), {pos(gen), pos(gen)});
+    }
+
+    for(double cell_size : {1.0, 8.0, 100.0}) {
+      CreatureGrid grid;
+      grid.build(creatures, world_size, cell_size);
+      ASSERT_EQ(grid.size(), creatures.size());
+
+      for(int query=0; query<50; query++) {
+        double x = pos(gen);
+        double y = pos(gen);
+        double radius = std::uniform_real_distribution<double>(0, 40)(gen);
+
+        std::vector<std::uint32_t> expected;
+        for(std::uint32_t i=0; i<creatures.size(); i++) {
+          if(toroidal_dist2(creatures.get_position(i), x, y, world_size) <= radius*radius) {
+            expected.push_back(i);
+          }
+        }
+        std::vector<std::uint32_t> found;
+        grid.within_radius(x, y, radius, found);
+        EXPECT_EQ(found, expected);
+
+        std::size_t k = std::uniform_int_distribution<std::size_t>(1, 20)(gen);
+        std::vector<std::uint32_t> by_dist(creatures.size());
+        for(std::uint32_t i=0; i<by_dist.size(); i++) {
+          by_dist[i] = i;
+        }
+        std::sort(by_dist.begin(), by_dist.end(), [&](std::uint32_t a, std::uint32_t b) {
+            auto dist_a = toroidal_dist2(creatures.get_position(a), x, y, world_size);
+            auto dist_b = toroidal_dist2(creatures.get_position(b), x, y, world_size);
+            return std::tie(dist_a, a) < std::tie(dist_b, b);
+          });
+        by_dist.resize(std::min(k, by_dist.size()));
+        std::vector<std::uint32_t> nearest;
+        grid.nearest(x, y, k, nearest);
+        EXPECT_EQ(nearest, by_dist);
+      }
+    }
+  }
+}
+
+TEST(CreatureGridTests, WrapsAroundEdges) {
+  CreatureTable creatures;
+  creatures.add(std::make_unique<CreatureBrain_Wander>(), {0.5, 63.5});
+  creatures.add(std::make_unique<CreatureBrain_Wander>(), {32, 32});
+
+  CreatureGrid grid;
+  grid.build(creatures, 64, 8);
+
+  std::vector<std::uint32_t> found;
+  grid.within_radius(63.5, 0.5, 2, found);
+  ASSERT_EQ(found.size(), 1U);
+  EXPECT_EQ(found[0], 0U);
+
+  found.clear();
+  grid.nearest(-0.5, 64.5, 1, found);
+  ASSERT_EQ(found.size(), 1U);
+  EXPECT_EQ(found[0], 0U);
+}
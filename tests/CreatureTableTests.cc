@@ -0,0 +1,183 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+#include "CreatureBrain_Wander.hh"
+#include "CreatureTable.hh"
+#include "DenseBitfield.hh"
+#include "GrassyBitfield.hh"
+#include "ThreadPool.hh"
+
+TEST(CreatureTableTests, MoveWrapsAndDecays) {
+  CreatureTable creatures;
+  creatures.add(std::make_unique<CreatureBrain_Wander>(), {63.5, 0.5}, 0, 1.0);
+  creatures.add(std::make_unique<CreatureBrain_Wander>(), {0.5, 0.5}, 3.1415926535897932/2, 1.0);
+  creatures.add(std::make_unique<CreatureBrain_Wander>(), {10.0, 0.25}, -3.1415926535897932/2, 1.0);
+
+  creatures.move(64);
+  EXPECT_DOUBLE_EQ(creatures.get_position(0).X(), 0.5);
+  EXPECT_DOUBLE_EQ(creatures.get_position(1).Y(), 1.5);
+  EXPECT_DOUBLE_EQ(creatures.get_position(2).Y(), 63.25);
+  for(std::size_t i=0; i<creatures.size(); i++) {
+    EXPECT_DOUBLE_EQ(creatures.get_speed(i), 0.95);
+    EXPECT_GE(creatures.get_position(i).X(), 0);
+    EXPECT_LT(creatures.get_position(i).X(), 64);
+  }
+}
+
+TEST(CreatureTableTests, UpdateKeepsCreaturesInWorld) {
+  DenseBitfield field(2, true);
+  CreatureTable creatures;
+  for(int i=0; i<100; i++) {
+    creatures.add(std::make_unique<CreatureBrain_Wander>(), {double(i%64), double(i/2)}, i);
+  }
+
+  std::vector<TileField::TileUpdate> updates;
+  for(int iter=0; iter<1000; iter++) {
+    creatures.update(3, iter, field, updates);
+  }
+  EXPECT_FALSE(updates.empty());
+
+  for(std::size_t i=0; i<creatures.size(); i++) {
+    auto pos = creatures.get_position(i);
+    EXPECT_GE(pos.X(), 0);
+    EXPECT_LT(pos.X(), 64);
+    EXPECT_GE(pos.Y(), 0);
+    EXPECT_LT(pos.Y(), 64);
+    EXPECT_GE(creatures.get_speed(i), 0);
+  }
+}
+
+TEST(CreatureTableTests, BatchedActionsMatchSingle) {
+  CreatureBrain_Wander brain;
+  std::vector<CounterRng> batched_gens;
+  for(int i=0; i<1000; i++) {
+    batched_gens.emplace_back(i);
+  }
+
+  std::vector<CreatureAction> actions(batched_gens.size());
+  brain.choose_actions(batched_gens.data(), nullptr, actions.size(), actions.data());
+  for(std::size_t i=0; i<actions.size(); i++) {
+    CounterRng single_gen(i);
+    EXPECT_EQ(actions[i], brain.choose_action(single_gen));
+  }
+}
+
+TEST(CreatureTableTests, ThreadsGiveSameResult) {
+  DenseBitfield field(3, true);
+  CreatureTable serial;
+  CreatureTable parallel;
+  for(int i=0; i<10000; i++) {
+    GVector<2> position(i%512, (i*7)%512);
+    serial.add(std::make_unique<CreatureBrain_Wander>(), position, i);
+    parallel.add(std::make_unique<CreatureBrain_Wander>(), position, i);
+  }
+
+  ThreadPool pool(4);
+  for(int iter=0; iter<20; iter++) {
+    std::vector<TileField::TileUpdate> serial_updates;
+    std::vector<TileField::TileUpdate> parallel_updates;
+    serial.update(7, iter, field, serial_updates);
+    parallel.update(7, iter, field, parallel_updates, &pool);
+
+    // Creatures near each other try to eat the same tiles, which are
+    // each eaten only once.
+    ASSERT_EQ(serial_updates.size(), parallel_updates.size());
+    for(std::size_t i=0; i<serial_updates.size(); i++) {
+      EXPECT_EQ(serial_updates[i].x, parallel_updates[i].x);
+      EXPECT_EQ(serial_updates[i].y, parallel_updates[i].y);
+      if(i > 0) {
+        EXPECT_TRUE(serial_updates[i].x != serial_updates[i-1].x ||
+                    serial_updates[i].y != serial_updates[i-1].y);
+      }
+    }
+    field.apply_updates(serial_updates);
+  }
+
+  for(std::size_t i=0; i<serial.size(); i++) {
+    EXPECT_EQ(serial.get_position(i).X(), parallel.get_position(i).X());
+    EXPECT_EQ(serial.get_position(i).Y(), parallel.get_position(i).Y());
+    EXPECT_EQ(serial.get_speed(i), parallel.get_speed(i));
+  }
+}
+
+TEST(CreatureTableTests, IdsSurviveRemoval) {
+  CreatureTable creatures;
+  std::vector<CreatureTable::Id> ids;
+  for(int i=0; i<4; i++) {
+    ids.push_back(creatures.add(std::make_unique<CreatureBrain_Wander>(), {double(i), 0}));
+  }
+
+  // The last creature is moved into the place of the removed one.
+  creatures.remove(1);
+  EXPECT_EQ(creatures.size(), 3U);
+  EXPECT_FALSE(creatures.find(ids[1]));
+  ASSERT_TRUE(creatures.find(ids[3]));
+  EXPECT_EQ(*creatures.find(ids[3]), 1U);
+  EXPECT_EQ(creatures.get_position(1).X(), 3);
+
+  // The slot is reused, with a new id.
+  auto new_id = creatures.add(std::make_unique<CreatureBrain_Wander>(), {5, 0});
+  EXPECT_NE(new_id, ids[1]);
+  EXPECT_EQ(std::uint32_t(new_id), std::uint32_t(ids[1]));
+  EXPECT_FALSE(creatures.find(ids[1]));
+  EXPECT_EQ(*creatures.find(new_id), 3U);
+  EXPECT_EQ(*creatures.find(ids[0]), 0U);
+}
+
+TEST(CreatureTableTests, Lifecycle) {
+  DenseBitfield full(2, true);
+  CreatureTable serial;
+  CreatureTable parallel;
+  for(int i=0; i<10; i++) {
+    serial.add(std::make_unique<CreatureBrain_Wander>(), {6.0*i, 6.0*i}, i);
+    parallel.add(std::make_unique<CreatureBrain_Wander>(), {6.0*i, 6.0*i}, i);
+  }
+  serial.set_lifecycle(true);
+  parallel.set_lifecycle(true);
+
+  // Creatures with plenty of food have children.
+  ThreadPool pool(3);
+  std::vector<TileField::TileUpdate> updates;
+  for(int iter=0; iter<300; iter++) {
+    serial.update(1, iter, full, updates);
+    parallel.update(1, iter, full, updates, &pool);
+  }
+  EXPECT_GT(serial.size(), 10U);
+  ASSERT_EQ(serial.size(), parallel.size());
+  for(std::size_t i=0; i<serial.size(); i++) {
+    EXPECT_EQ(serial.get_id(i), parallel.get_id(i));
+    EXPECT_EQ(serial.get_position(i).X(), parallel.get_position(i).X());
+    EXPECT_EQ(serial.get_energy(i), parallel.get_energy(i));
+  }
+
+  // Without food, every creature dies.
+  DenseBitfield empty(2);
+  for(int iter=0; iter<200 && serial.size(); iter++) {
+    serial.update(1, iter, empty, updates);
+  }
+  EXPECT_EQ(serial.size(), 0U);
+}
+
+TEST(CreatureTableTests, SenseFood) {
+  GrassyBitfield food(2);
+  food.fill_rect(40, 28, 48, 36);
+
+  CreatureTable creatures;
+  creatures.add(std::make_unique<CreatureBrain_Wander>(), {32, 32});
+  creatures.add(std::make_unique<CreatureBrain_Wander>(), {32, 32}, 3.1415926535897932/2);
+
+  std::vector<CreatureTable::FoodSense> senses;
+  creatures.sense_food(food, 16, senses);
+  ASSERT_EQ(senses.size(), 2U);
+
+  // Food straight ahead of the first creature, and to the right of
+  // the second.
+  EXPECT_GT(senses[0].center, 0);
+  EXPECT_EQ(senses[0].left, 0);
+  EXPECT_EQ(senses[0].right, 0);
+  EXPECT_DOUBLE_EQ(senses[0].ahead, 8);
+  EXPECT_EQ(senses[1].center, 0);
+  EXPECT_GT(senses[1].right, 0);
+  EXPECT_EQ(senses[1].ahead, 16);
+}
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include "DenseBitfield.hh"
+#include "GrassyBitfield.hh"
+
+namespace {
+  void expect_same(const TileField& sparse, const TileField& dense) {
+    ASSERT_EQ(sparse.get_size(), dense.get_size());
+    ASSERT_EQ(sparse.num_filled(), dense.num_filled());
+    for(std::uint32_t y=0; y<sparse.get_size(); y++) {
+      for(std::uint32_t x=0; x<sparse.get_size(); x++) {
+        ASSERT_EQ(sparse.get_val(x, y), dense.get_val(x, y));
+      }
+    }
+  }
+}
+
+TEST(DenseBitfieldTests, Construct) {
+  DenseBitfield field(2);
+  EXPECT_EQ(field.get_size(), 64U);
+  EXPECT_EQ(field.num_filled(), 0U);
+
+  DenseBitfield full(1, true);
+  EXPECT_EQ(full.num_filled(), 64U);
+  EXPECT_TRUE(full.get_val(7, 7));
+
+  EXPECT_THROW(DenseBitfield(0), std::invalid_argument);
+  EXPECT_THROW(field.get_val(0, 0, 1), std::invalid_argument);
+}
+
+TEST(DenseBitfieldTests, MatchesSparse) {
+  for(unsigned int num_layers : {1, 2, 3}) {
+    for(bool edge_wrap : {true, false}) {
+      GrassyBitfield sparse(num_layers, false, edge_wrap);
+      DenseBitfield dense(num_layers, false, edge_wrap);
+      auto size = sparse.get_size();
+
+      std::mt19937 gen(10*num_layers + edge_wrap);
+      std::uniform_int_distribution<std::uint32_t> tile(0, size-1);
+      std::uniform_int_distribution<int> op(0, 9);
+
+      std::vector<GrassyBitfield::Location> seeds;
+      for(int i=0; i<5; i++) {
+        seeds.push_back({tile(gen), tile(gen)});
+      }
+      sparse.load_tiles(seeds);
+      dense.load_tiles(seeds);
+      expect_same(sparse, dense);
+
+      for(int step=0; step<100; step++) {
+        auto choice = op(gen);
+        if(choice < 3) {
+          auto x = tile(gen);
+          auto y = tile(gen);
+          bool value = gen()%4 != 0;
+          sparse.set_val(x, y, value);
+          dense.set_val(x, y, value);
+        } else if(choice < 5) {
+          std::vector<GrassyBitfield::TileUpdate> updates;
+          for(int i=0; i<20; i++) {
+            updates.push_back({tile(gen), tile(gen), gen()%2 == 0});
+          }
+          sparse.apply_updates(updates);
+          dense.apply_updates(updates);
+        } else {
+          sparse.growth_iteration();
+          dense.growth_iteration();
+        }
+        expect_same(sparse, dense);
+
+        // Half-integer positions are equally near several tiles, and
+        // must be broken the same way.
+        for(int i=0; i<10; i++) {
+          double x = 0.5*std::uniform_int_distribution<int>(-4, 2*size+4)(gen);
+          double y = 0.5*std::uniform_int_distribution<int>(-4, 2*size+4)(gen);
+          double radius = std::uniform_real_distribution<double>(0, size/2.0)(gen);
+          auto from_sparse = sparse.find_nearest_set(x, y, radius);
+          auto from_dense = dense.find_nearest_set(x, y, radius);
+          ASSERT_EQ(bool(from_sparse), bool(from_dense));
+          if(from_sparse) {
+            EXPECT_EQ(from_sparse->x, from_dense->x);
+            EXPECT_EQ(from_sparse->y, from_dense->y);
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(DenseBitfieldTests, GrowthReportsNewTiles) {
+  DenseBitfield field(2);
+  field.set_val(0, 0, true);
+
+  std::vector<TileField::TileUpdate> new_tiles;
+  field.growth_iteration(new_tiles);
+  EXPECT_EQ(field.num_filled(), 5U);
+  EXPECT_EQ(new_tiles.size(), 4U);
+  for(const auto& update : new_tiles) {
+    EXPECT_TRUE(update.value);
+    EXPECT_TRUE(field.get_val(update.x, update.y));
+  }
+
+  DenseBitfield copy(field);
+  GrassyBitfield sparse(2);
+  sparse.set_val(0, 0, true);
+  sparse.apply_updates(new_tiles);
+  expect_same(sparse, DenseBitfield(sparse));
+  expect_same(sparse, copy);
+}
@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+
+#include "WorldSim.hh"
+
+TEST(WorldSimTests, SaveAndLoad) {
+  auto path = (std::filesystem::temp_directory_path() / "WorldSimTests_SaveAndLoad").string();
+
+  WorldSim sim(2, 5);
+  for(int i=0; i<50; i++) {
+    sim.iterate();
+  }
+  sim.Save(path);
+  auto loaded = WorldSim::Load(path);
+  std::filesystem::remove(path);
+
+  // The loaded world continues exactly as the original.
+  for(int i=0; i<50; i++) {
+    sim.iterate();
+    loaded.iterate();
+  }
+
+  for(int y=0; y<sim.GetSize(); y++) {
+    for(int x=0; x<sim.GetSize(); x++) {
+      ASSERT_EQ(loaded.GetFoodAt(x, y), sim.GetFoodAt(x, y));
+    }
+  }
+
+  const auto& creatures = sim.GetCreatures();
+  const auto& loaded_creatures = loaded.GetCreatures();
+  ASSERT_EQ(loaded_creatures.size(), creatures.size());
+  for(unsigned int i=0; i<creatures.size(); i++) {
+    EXPECT_EQ(loaded_creatures.get_position(i).X(), creatures.get_position(i).X());
+    EXPECT_EQ(loaded_creatures.get_position(i).Y(), creatures.get_position(i).Y());
+    EXPECT_EQ(loaded_creatures.get_speed(i), creatures.get_speed(i));
+  }
+}
+
+TEST(WorldSimTests, SaveAndLoadLifecycle) {
+  auto path = (std::filesystem::temp_directory_path() / "WorldSimTests_SaveAndLoadLifecycle").string();
+
+  WorldSim sim(2, 5);
+  sim.SetCreatureLifecycle(true);
+  for(int i=0; i<100; i++) {
+    sim.iterate();
+  }
+  sim.Save(path);
+  auto loaded = WorldSim::Load(path);
+  std::filesystem::remove(path);
+  EXPECT_TRUE(loaded.GetCreatureLifecycle());
+
+  // Creatures born after loading have the same ids.
+  for(int i=0; i<200; i++) {
+    sim.iterate();
+    loaded.iterate();
+  }
+  const auto& creatures = sim.GetCreatures();
+  const auto& loaded_creatures = loaded.GetCreatures();
+  ASSERT_EQ(loaded_creatures.size(), creatures.size());
+  for(unsigned int i=0; i<creatures.size(); i++) {
+    EXPECT_EQ(loaded_creatures.get_id(i), creatures.get_id(i));
+    EXPECT_EQ(loaded_creatures.get_position(i).X(), creatures.get_position(i).X());
+    EXPECT_EQ(loaded_creatures.get_energy(i), creatures.get_energy(i));
+  }
+}
+
+TEST(WorldSimTests, Freeze) {
+  WorldSim sim(2, 5);
+  sim.SetIterationsPerGrowth(1);
+  auto frozen = sim.Freeze();
+  std::vector<double> food;
+  for(int y=0; y<sim.GetSize(); y++) {
+    for(int x=0; x<sim.GetSize(); x++) {
+      food.push_back(sim.GetFoodAt(x, y));
+    }
+  }
+  auto position = sim.GetCreatures().get_position(0);
+
+  for(int i=0; i<20; i++) {
+    sim.iterate();
+  }
+
+  // The frozen copy still holds the world as it was.
+  EXPECT_NE(sim.Freeze().food.num_filled(), frozen.food.num_filled());
+  for(int y=0; y<sim.GetSize(); y++) {
+    for(int x=0; x<sim.GetSize(); x++) {
+      ASSERT_EQ(frozen.food.get_val(x, y), food[y*sim.GetSize() + x]);
+    }
+  }
+  ASSERT_EQ(frozen.creatures->size(), 1U);
+  EXPECT_EQ((*frozen.creatures)[0].position.X(), position.X());
+  EXPECT_EQ((*frozen.creatures)[0].position.Y(), position.Y());
+}
+
+TEST(WorldSimTests, Seek) {
+  WorldSim sim(2, 5);
+  sim.SetIterationsPerGrowth(1);
+  std::vector<WorldSim::Frozen> frozen;
+  frozen.push_back(sim.Freeze());
+  for(int i=0; i<60; i++) {
+    // Ticks after the change are not replayed with the old setting.
+    if(i == 30) {
+      sim.SetIterationsPerGrowth(3);
+    }
+    sim.iterate();
+    frozen.push_back(sim.Freeze());
+  }
+  EXPECT_EQ(sim.GetTick(), 60U);
+  EXPECT_EQ(sim.GetHistoryStart(), 0U);
+
+  // Every tick is reconstructed as it was.
+  for(std::uint64_t tick=0; tick<=sim.GetTick(); tick++) {
+    auto past = sim.Seek(tick);
+    const auto& expected = frozen[tick];
+    EXPECT_EQ(past.tick, tick);
+    ASSERT_EQ(past.food.num_filled(), expected.food.num_filled());
+    for(int y=0; y<sim.GetSize(); y++) {
+      for(int x=0; x<sim.GetSize(); x++) {
+        ASSERT_EQ(past.food.get_val(x, y), expected.food.get_val(x, y));
+      }
+    }
+    ASSERT_EQ(past.creatures->size(), expected.creatures->size());
+    EXPECT_EQ((*past.creatures)[0].position.X(), (*expected.creatures)[0].position.X());
+    EXPECT_EQ((*past.creatures)[0].position.Y(), (*expected.creatures)[0].position.Y());
+    EXPECT_EQ((*past.creatures)[0].direction, (*expected.creatures)[0].direction);
+    EXPECT_EQ((*past.creatures)[0].speed, (*expected.creatures)[0].speed);
+  }
+  EXPECT_THROW(sim.Seek(sim.GetTick() + 1), std::out_of_range);
+
+  // With a small budget, only the most recent ticks are kept.
+  sim.SetHistoryBudget(1);
+  for(int i=0; i<60; i++) {
+    sim.iterate();
+  }
+  EXPECT_GT(sim.GetHistoryStart(), 60U);
+  EXPECT_THROW(sim.Seek(0), std::out_of_range);
+  EXPECT_EQ(sim.Seek(sim.GetTick()).food.num_filled(), sim.Freeze().food.num_filled());
+}
+
+TEST(WorldSimTests, DenseFoodStorage) {
+  WorldSim sparse(2, 5, WorldSim::FoodStorage::Sparse);
+  WorldSim dense(2, 5, WorldSim::FoodStorage::Dense);
+  EXPECT_EQ(sparse.GetFoodStorage(), WorldSim::FoodStorage::Sparse);
+  EXPECT_EQ(dense.GetFoodStorage(), WorldSim::FoodStorage::Dense);
+  EXPECT_EQ(WorldSim(2).GetFoodStorage(), WorldSim::FoodStorage::Sparse);
+
+  // Both backends give the same world.
+  for(int i=0; i<100; i++) {
+    sparse.iterate();
+    dense.iterate();
+  }
+  for(int y=0; y<sparse.GetSize(); y++) {
+    for(int x=0; x<sparse.GetSize(); x++) {
+      ASSERT_EQ(dense.GetFoodAt(x, y), sparse.GetFoodAt(x, y));
+    }
+  }
+  auto position = sparse.GetCreatures().get_position(0);
+  auto dense_position = dense.GetCreatures().get_position(0);
+  EXPECT_EQ(dense_position.X(), position.X());
+  EXPECT_EQ(dense_position.Y(), position.Y());
+}
@@ -2,6 +2,8 @@ function connect_callbacks() {
     var all_callbacks = [
         ['iterate-button', 'click', iterate],
         ['reset-world-button', 'click', reset_world],
+        ['seek-tick-button', 'click', seek_tick],
+        ['live-button', 'click', view_live],
     ];
 
     all_callbacks.forEach(function(cb) {
@@ -19,3 +21,14 @@ function reset_world() {
     send_message({'reset_world': true,
                   'food_dist_requested': true});
 }
+
+function seek_tick() {
+    var tick = +document.getElementById('seek-tick').value;
+    send_message({'seek_tick': tick});
+}
+
+function view_live() {
+    world_state.viewing_tick = null;
+    document.getElementById('viewing-tick').innerHTML = 'live';
+    send_message({'full_map_requested': true});
+}
@@ -2,14 +2,25 @@ var world_state = {
     size: null,
     food_fields: null,
     creatures: null,
+    // Tick being viewed from the history, or null if live.
+    viewing_tick: null,
 };
 
 function update_world_display(message) {
     var needs_redraw = false;
 
+    update_tick_display(message);
+
+    // While viewing a past tick, live updates are ignored.  Returning
+    // to live requests the full map.
+    if('history_tick' in message) {
+        world_state.viewing_tick = message.history_tick;
+    } else if(world_state.viewing_tick !== null) {
+        return;
+    }
+
     if('food_dist' in message) {
-        world_state.size = message.food_dist.size;
-        world_state.food_fields = message.food_dist.food_fields;
+        update_food_fields(message.food_dist);
         needs_redraw = true;
     }
 
@@ -23,6 +34,41 @@ function update_world_display(message) {
     }
 }
 
+function update_tick_display(message) {
+    if('tick' in message) {
+        document.getElementById('current-tick').innerHTML = message.tick;
+    }
+    if('history_start' in message) {
+        document.getElementById('history-start').innerHTML = message.history_start;
+    }
+    if('history_tick' in message) {
+        document.getElementById('viewing-tick').innerHTML = 'tick ' + message.history_tick;
+    }
+    if('history_error' in message) {
+        document.getElementById('viewing-tick').innerHTML = message.history_error;
+    }
+}
+
+function field_id(field) {
+    return field.x_min + ',' + field.y_min + ',' + field.width;
+}
+
+function update_food_fields(food_dist) {
+    // Updates only hold the fields that have changed, unless a full
+    // refresh is sent.
+    if(food_dist.full_refresh || world_state.food_fields === null) {
+        world_state.food_fields = {};
+    }
+    world_state.size = food_dist.size;
+
+    food_dist.removed_fields.forEach(field => {
+        delete world_state.food_fields[field_id(field)];
+    });
+    food_dist.food_fields.forEach(field => {
+        world_state.food_fields[field_id(field)] = field;
+    });
+}
+
 function redraw_canvas() {
     var canvas = document.getElementById('map-display');
     var ctx = canvas.getContext('2d');
@@ -36,7 +82,10 @@ function redraw_canvas() {
 
 
 function draw_food_fields(ctx) {
-    var food_fields = world_state.food_fields;
+    // Larger fields are drawn first, so that the subfields on top of
+    // them are visible.
+    var food_fields = Object.values(world_state.food_fields);
+    food_fields.sort((a, b) => b.width - a.width);
     var size = world_state.size;
 
     var dummy = document.createElement('canvas');